@@ -1,17 +1,140 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <cctype>
 #include <stdexcept>
 #include <fstream>
 #include <vector>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
+#include <set>
 #include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <exception>
+#include <atomic>
+#include <thread>
+#include <charconv>
+#include <chrono>
+#include <bit>
+#include <map>
+#include <new>
+#include <cstdlib>
+#include <cmath>
+#include <filesystem>
+#include <mutex>
+#include <deque>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+// Asynchronous output drains its ring buffer with writev, which needs POSIX.
+#if __has_include(<sys/uio.h>) && __has_include(<unistd.h>)
+#define KLANG_ASYNC_OUTPUT 1
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// Reduction loops can run in AVX2 lanes. The code is compiled for AVX2 per function and only called if the CPU supports it.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KLANG_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Programs run on a thread with a stack of a configurable size, which needs pthreads.
+#if __has_include(<pthread.h>)
+#define KLANG_STACK_THREAD 1
+#include <pthread.h>
+#endif
+
+// A bundled program is found in the running executable through /proc and mapped into memory, which needs Linux.
+#if defined(__linux__) && __has_include(<sys/mman.h>) && __has_include(<sys/stat.h>) && __has_include(<fcntl.h>)
+#define KLANG_BUNDLE 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The benchmark mode pins itself to one CPU, which needs the Linux affinity API.
+#if defined(__linux__) && __has_include(<sched.h>)
+#define KLANG_PIN_CPU 1
+#include <sched.h>
+#endif
+
+/*
+Counts heap allocations for --alloc-report, split by the phase of the run that made them, through the replaceable global operator
+new and delete below. Counting is off unless the option is given, so otherwise the hooks only add one relaxed load to each call.
+*/
+class AllocationTracker {
+public:
+    enum Phase { Other, Parse, Optimize, Execute, PhaseCount };
+
+    struct Counts {
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> frees;
+    };
+
+    static inline std::atomic<bool> enabled{false};
+    static inline std::atomic<int> phase{Other};
+    static inline Counts counts[PhaseCount];
+
+    static void allocated(size_t size) {
+        if (!enabled.load(std::memory_order_relaxed)) return;
+        Counts& current = counts[phase.load(std::memory_order_relaxed)];
+        current.allocations.fetch_add(1, std::memory_order_relaxed);
+        current.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    static void freed() {
+        if (!enabled.load(std::memory_order_relaxed)) return;
+        counts[phase.load(std::memory_order_relaxed)].frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //Attributes allocations to a phase until it goes out of scope, then goes back to the phase before it.
+    class Scope {
+    private:
+        int previous;
+
+    public:
+        explicit Scope(Phase phase_) : previous(phase.exchange(phase_, std::memory_order_relaxed)) {}
+        ~Scope() {
+            phase.store(previous, std::memory_order_relaxed);
+        }
+    };
+
+    static void print(std::ostream& out) {
+        static const char* const names[PhaseCount] = {"other", "parse", "optimize", "execute"};
+        for (int k = 0; k < PhaseCount; k++) {
+            out << "allocations in " << names[k] << ": " << counts[k].allocations.load() << " (" << counts[k].bytes.load()
+                << " bytes), " << counts[k].frees.load() << " frees" << std::endl;
+        }
+    }
+};
+
+void* operator new(std::size_t size) {
+    AllocationTracker::allocated(size);
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    if (!memory) return;
+    AllocationTracker::freed();
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    operator delete(memory);
+}
 
 enum TokenType {
     INTEGER, PLUS, MINUS, MUL, DIV, LPAREN, RPAREN, EOF_TOKEN, ID, ASSIGN, COMMA, PRINT,
     EQUAL_TO, NOT_EQUAL_TO, GREATER_THAN, LESS_THAN, GREATER_THAN_OR_EQUAL_TO, LESS_THAN_OR_EQUAL_TO,
-    IF, THEN, END, AND, OR, FOR, TO, WHILE
+    IF, THEN, END, AND, OR, FOR, TO, WHILE, LOCAL
 };
 
 class Token {
@@ -30,14 +153,24 @@ public:
 /* Converts string input into a stream of tokens. */
 class Lexer {
 public:
-    std::string text;
+    //The source, shared by the copies of a lexer, and the part of it that this lexer reads.
+    std::shared_ptr<const std::string> source;
+    std::string_view text;
     size_t pos;
     char current_char;
+    //The line of current_char, counting from 1.
+    int line = 1;
 
-    Lexer(const std::string& text_) : text(text_), pos(0), current_char(text[pos]) {}
+    Lexer(const std::string& text_) : Lexer(std::make_shared<const std::string>(text_), 0, text_.size(), 1) {}
+
+    //Reads the characters from 'start' up to 'end' of a shared source, with the first on line 'line_'.
+    Lexer(std::shared_ptr<const std::string> source_, size_t start, size_t end, int line_)
+        : source(std::move(source_)), text(std::string_view(*source).substr(start, end - start)), pos(0),
+          current_char(text.empty() ? '\0' : text[0]), line(line_) {}
 
     // Advance the 'pos' pointer and set the 'current_char' variable
     void advance() {
+        if (current_char == '\n') line++;
         pos++;
         current_char = (pos >= text.size()) ? '\0' : text[pos];
     }
@@ -76,7 +209,8 @@ public:
             {"or", OR},
             {"for", FOR},
             {"to", TO},
-            {"while", WHILE}
+            {"while", WHILE},
+            {"local", LOCAL}
         };
 
         auto it = keywords.find(id);
@@ -168,7 +302,19 @@ public:
     }
 };
 
-//
+/*
+Locals declared in a block live in frame slots, which are variables named '$' followed by the slot's depth in the frame. The name
+can't be written in a program, and the parser only lets a frame slot be read after the declaration that writes it, so its value
+never outlives the block.
+*/
+inline bool is_frame_slot(const std::string& name) {
+    return !name.empty() && name[0] == '$';
+}
+
+/*
+Stores variables in numbered slots. A name is given a slot the first time it is seen and keeps it for the whole run,
+so nodes can resolve a name once and then read and write the slot directly.
+*/
 class SymbolTable {
 public:
 
@@ -179,28 +325,487 @@ public:
     };
 
 private:
-    std::unordered_map<std::string, Entry> table;
+    struct Slot {
+        std::string name;
+        std::string type;
+        bool defined = false;
+        int value = 0;
+    };
+
+    std::unordered_map<std::string, size_t> slots;
+    std::vector<Slot> table;
 
 public:
 
+    //Returns the slot of a variable, creating an undefined one if the name is new.
+    size_t slot(const std::string& name) {
+        auto it = slots.find(name);
+        if (it != slots.end()) {
+            return it->second;
+        }
+        slots.emplace(name, table.size());
+        table.push_back({name, "", false, 0});
+        return table.size() - 1;
+    }
+
+    bool defined(size_t slot) const {
+        return table[slot].defined;
+    }
+
+    int value(size_t slot) const {
+        return table[slot].value;
+    }
+
+    //Writes an integer to a slot. Every value in the language is an INTEGER, so this cannot be a type mismatch.
+    void set(size_t slot, int value) {
+        Slot& entry = table[slot];
+        entry.type = "INTEGER";
+        entry.defined = true;
+        entry.value = value;
+    }
+
+    const std::string& name(size_t slot) const {
+        return table[slot].name;
+    }
+
+    size_t size() const {
+        return table.size();
+    }
+
     //When it encounters a new variable, it will check if it already exists in the symbol table. If it does, it will update the existing one. If not then it will add a new entry. 
     void addOrUpdate(const std::string& name, const std::string& type, const std::string& value) {
-        if (table.find(name) != table.end() && table[name].type != type) {
+        Slot& entry = table[slot(name)];
+        if (entry.defined && entry.type != type) {
             throw std::runtime_error("Type mismatch for variable: " + name);
         }
-        table[name] = {type, value};
+        entry.type = type;
+        entry.defined = true;
+        entry.value = std::stoi(value);
     }
 
     //Retrieves a variable from the table. If it doesn't exist, it will return an empty optional.
     std::optional<Entry> get(const std::string& name) const {
-        auto it = table.find(name);
-        if (it != table.end()) {
-            return it->second;
+        auto it = slots.find(name);
+        if (it != slots.end() && table[it->second].defined) {
+            const Slot& entry = table[it->second];
+            return Entry{entry.type, std::to_string(entry.value)};
         }
         return std::nullopt;
     }
 };
 
+//Where the output of print statements goes. Engines write through it instead of to std::cout directly.
+class Output {
+public:
+    virtual ~Output() = default;
+    virtual void write(const char* data, size_t size) = 0;
+    //Marks the end of the output of one print statement.
+    virtual void commit() = 0;
+    //Blocks until everything written so far has reached stdout, so that anything written to stderr afterwards comes after it.
+    virtual void flush() = 0;
+
+    void write(char c) {
+        write(&c, 1);
+    }
+};
+
+//Writes to std::cout, flushing after every print statement.
+class StreamOutput : public Output {
+public:
+    using Output::write;
+
+    void write(const char* data, size_t size) override {
+        std::cout.write(data, size);
+    }
+
+    void commit() override {
+        std::cout.flush();
+    }
+
+    void flush() override {
+        std::cout.flush();
+    }
+};
+
+//Discards everything, so that --bench measures the interpreter rather than the terminal.
+class NullOutput : public Output {
+public:
+    using Output::write;
+
+    void write(const char*, size_t) override {}
+    void commit() override {}
+    void flush() override {}
+};
+
+#ifdef KLANG_ASYNC_OUTPUT
+/*
+Formats output into a single-producer/single-consumer ring buffer that a writer thread drains into stdout with writev, so a slow
+consumer of stdout doesn't stall the interpreter until the ring is full. 'head' and 'tail' count the bytes produced and consumed
+so far; the interpreter only advances 'head' and the writer only advances 'tail'. Completed prints are published by storing 'head',
+and when the ring is full the interpreter waits for 'tail' to move. The top bit of 'head' tells the writer to finish and exit.
+*/
+class AsyncOutput : public Output {
+private:
+    static constexpr size_t capacity = size_t(1) << 16;
+    static constexpr size_t closedBit = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+    std::unique_ptr<char[]> ring;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    size_t produced = 0;
+    std::thread writer;
+
+    void publish(size_t flags = 0) {
+        head.store(produced | flags, std::memory_order_release);
+        head.notify_one();
+    }
+
+    void drain() {
+        size_t consumed = 0;
+        bool failed = false;
+        while (true) {
+            size_t published = head.load(std::memory_order_acquire);
+            size_t available = (published & ~closedBit) - consumed;
+            if (available == 0) {
+                if (published & closedBit) return;
+                head.wait(published, std::memory_order_acquire);
+                continue;
+            }
+
+            //A write error (a closed pipe, a full disk) drops the rest of the output, as it would for std::cout.
+            while (available > 0 && !failed) {
+                size_t start = consumed % capacity;
+                size_t first = std::min(available, capacity - start);
+                iovec parts[2] = {{ring.get() + start, first}, {ring.get(), available - first}};
+                ssize_t written = writev(STDOUT_FILENO, parts, available > first ? 2 : 1);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    failed = true;
+                    break;
+                }
+                consumed += written;
+                available -= written;
+                tail.store(consumed, std::memory_order_release);
+                tail.notify_one();
+            }
+            if (failed) {
+                consumed += available;
+                tail.store(consumed, std::memory_order_release);
+                tail.notify_one();
+            }
+        }
+    }
+
+public:
+    using Output::write;
+
+    AsyncOutput() : ring(new char[capacity]) {
+        writer = std::thread([this] { drain(); });
+    }
+
+    ~AsyncOutput() override {
+        publish(closedBit);
+        writer.join();
+    }
+
+    void write(const char* data, size_t size) override {
+        while (size > 0) {
+            size_t consumed = tail.load(std::memory_order_acquire);
+            size_t space = capacity - (produced - consumed);
+            if (space == 0) {
+                //Backpressure: hand the writer what is buffered and wait for it to make room.
+                publish();
+                tail.wait(consumed, std::memory_order_acquire);
+                continue;
+            }
+            size_t chunk = std::min({size, space, capacity - produced % capacity});
+            std::copy(data, data + chunk, ring.get() + produced % capacity);
+            produced += chunk;
+            data += chunk;
+            size -= chunk;
+        }
+    }
+
+    void commit() override {
+        publish();
+    }
+
+    void flush() override {
+        publish();
+        size_t consumed;
+        while ((consumed = tail.load(std::memory_order_acquire)) != produced) {
+            tail.wait(consumed, std::memory_order_acquire);
+        }
+    }
+};
+#endif
+
+//Encodes the values of print statements into an Output. The engines pass each value as it is computed and call 'end' after the last one.
+class Printer {
+public:
+    explicit Printer(Output& output_) : output(output_) {}
+    virtual ~Printer() = default;
+    //Called before every value but the first, before that value is evaluated.
+    virtual void separator() = 0;
+    virtual void value(int value) = 0;
+    virtual void end() = 0;
+
+protected:
+    Output& output;
+};
+
+//Decimal values separated by spaces, one line per print statement.
+class TextPrinter : public Printer {
+public:
+    using Printer::Printer;
+
+    void separator() override {
+        output.write(' ');
+    }
+
+    void value(int value) override {
+        char digits[16];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        output.write(digits, result.ptr - digits);
+    }
+
+    void end() override {
+        output.write('\n');
+        output.commit();
+    }
+};
+
+/*
+One record per print statement: the number of values as a little-endian uint32, then each value as a little-endian int64. A record is
+only written once it is complete, so a print that fails partway through writes nothing.
+*/
+class BinaryPrinter : public Printer {
+private:
+    std::vector<int> values;
+    std::vector<char> record;
+
+    void append(uint64_t bits, int bytes) {
+        for (int k = 0; k < bytes; k++) {
+            record.push_back(static_cast<char>(bits >> (8 * k)));
+        }
+    }
+
+public:
+    using Printer::Printer;
+
+    void separator() override {}
+
+    void value(int value) override {
+        values.push_back(value);
+    }
+
+    void end() override {
+        record.clear();
+        append(values.size(), 4);
+        for (int value : values) {
+            append(static_cast<uint64_t>(static_cast<int64_t>(value)), 8);
+        }
+        values.clear();
+        output.write(record.data(), record.size());
+        output.commit();
+    }
+};
+
+//One JSON array per print statement, each on its own line. Like binary records, a print that fails partway through writes nothing.
+class JsonPrinter : public Printer {
+private:
+    std::string line;
+
+public:
+    using Printer::Printer;
+
+    void separator() override {}
+
+    void value(int value) override {
+        line += line.empty() ? '[' : ',';
+        char digits[16];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        line.append(digits, result.ptr - digits);
+    }
+
+    void end() override {
+        if (line.empty()) line += '[';
+        line += "]\n";
+        output.write(line.data(), line.size());
+        output.commit();
+        line.clear();
+    }
+};
+
+/*
+Records the events of a --trace run into a buffer allocated up front, and writes them out as Chrome trace-event JSON (for
+chrome://tracing or Perfetto) once the run is over, so tracing costs two clock reads per event and no I/O while the program runs.
+Timestamps come from steady_clock, relative to when the tracer was created. Events past the buffer's capacity are counted and dropped.
+*/
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Arg {
+        const char* name = nullptr;
+        int64_t value = 0;
+    };
+
+    struct Event {
+        const char* name;
+        const char* category;
+        Clock::time_point start;
+        Clock::duration duration;
+        Arg args[3];
+    };
+
+    static constexpr size_t capacity = size_t(1) << 16;
+    //Loops are only recorded when they run at least this long.
+    static constexpr Clock::duration longLoop = std::chrono::milliseconds(1);
+
+private:
+    Clock::time_point origin;
+    std::vector<Event> events;
+    size_t dropped = 0;
+
+    static double micros(Clock::duration duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+
+public:
+    Tracer() : origin(Clock::now()) {
+        events.reserve(capacity);
+    }
+
+    static Clock::time_point now() {
+        return Clock::now();
+    }
+
+    void record(const char* name, const char* category, Clock::time_point start, Clock::time_point end, std::initializer_list<Arg> args = {}) {
+        if (events.size() == capacity) {
+            dropped++;
+            return;
+        }
+        Event event{name, category, start, end - start, {}};
+        std::copy(args.begin(), args.begin() + std::min<size_t>(args.size(), 3), event.args);
+        events.push_back(event);
+    }
+
+    void write(std::ostream& out) const {
+        out << "{\"traceEvents\":[";
+        out << std::fixed;
+        out.precision(3);
+        for (size_t k = 0; k < events.size(); k++) {
+            const Event& event = events[k];
+            out << (k ? ",\n" : "\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << micros(event.start - origin) << ",\"dur\":" << micros(event.duration)
+                << ",\"args\":{";
+            for (int a = 0; a < 3 && event.args[a].name; a++) {
+                out << (a ? "," : "") << '"' << event.args[a].name << "\":" << event.args[a].value;
+            }
+            out << "}}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+    }
+};
+
+//What --loop-stats records about the loops on one source line.
+struct LoopProfile {
+    //Bucket 0 counts runs with no iterations, and bucket k runs with 2^(k-1) to 2^k - 1 iterations.
+    static constexpr int buckets = 65;
+
+    int line;
+    const char* kind;
+    uint64_t entries = 0;
+    uint64_t iterations = 0;
+    Tracer::Clock::duration time{};
+    uint64_t histogram[buckets] = {};
+
+    LoopProfile(int line_, const char* kind_) : line(line_), kind(kind_) {}
+
+    void record(uint64_t trips, Tracer::Clock::duration duration) {
+        entries++;
+        iterations += trips;
+        time += duration;
+        histogram[std::bit_width(trips)]++;
+    }
+};
+
+/*
+Collects loop profiles for --loop-stats, one per source line and kind of loop, so copies of a loop made by unrolling add up with the
+original. Loops the optimizer removed by unrolling them completely, or merged by fusion, are counted as what they became.
+*/
+class LoopStats {
+private:
+    std::map<std::pair<int, std::string>, LoopProfile> profiles;
+
+public:
+    LoopProfile* profile(int line, const char* kind) {
+        return &profiles.try_emplace({line, kind}, line, kind).first->second;
+    }
+
+    //Prints the loops from the most to the least time spent in them, with their trip-count histograms.
+    void print(std::ostream& out) const {
+        std::vector<const LoopProfile*> ranked;
+        for (const auto& entry : profiles) {
+            ranked.push_back(&entry.second);
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const LoopProfile* a, const LoopProfile* b) {
+            return a->time > b->time;
+        });
+
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision(3);
+        out << std::fixed;
+        out << "loop stats: " << ranked.size() << " loops, by time spent in them" << std::endl;
+        for (const LoopProfile* loop : ranked) {
+            double ms = std::chrono::duration<double, std::milli>(loop->time).count();
+            out << "line " << loop->line << " (" << loop->kind << "): " << loop->entries << " entries, " << loop->iterations
+                << " iterations, " << ms << " ms" << std::endl;
+            out << "    trip counts:";
+            const char* separator = " ";
+            for (int k = 0; k < LoopProfile::buckets; k++) {
+                if (!loop->histogram[k]) continue;
+                out << separator;
+                separator = ", ";
+                if (k <= 1) {
+                    out << k;
+                } else {
+                    uint64_t low = uint64_t(1) << (k - 1);
+                    out << low << '-' << (low * 2 - 1);
+                }
+                out << " (" << loop->histogram[k] << (loop->histogram[k] == 1 ? " run)" : " runs)");
+            }
+            out << std::endl;
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
+/*
+Integer arithmetic wraps around on overflow (two's complement) instead of being undefined behavior.
+This gives every optimization pass a precise definition to preserve, e.g. x * 8 and x << 3 always agree.
+*/
+inline int wrapping_add(int a, int b) {
+    return static_cast<int>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
+}
+
+inline int wrapping_sub(int a, int b) {
+    return static_cast<int>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+}
+
+inline int wrapping_mul(int a, int b) {
+    return static_cast<int>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b));
+}
+
+//Divides with truncation toward zero. The only overflowing case, INT_MIN / -1, wraps back to INT_MIN.
+inline int checked_div(int a, int b) {
+    if (b == 0) throw std::runtime_error("Division by zero");
+    if (b == -1) return wrapping_sub(0, a);
+    return a / b;
+}
+
 // Different types of AST nodes
 class AST;
 class BinaryOpNode;
@@ -213,6 +818,14 @@ class WhileNode;
 class ForNode;
 class ComparisonNode;
 class LogicalOpNode;
+class DivideByConstantNode;
+class ShiftLeftNode;
+class IncrementNode;
+class AddVariablesNode;
+class CompareConstantIfNode;
+class CompareConstantWhileNode;
+class LazyBodyNode;
+class Interpreter;
 
 // Visitor interface
 class ASTVisitor {
@@ -227,14 +840,43 @@ public:
     virtual void visit(ForNode* node) = 0;
     virtual void visit(ComparisonNode* node) = 0;
     virtual void visit(LogicalOpNode* node) = 0;
+    virtual void visit(DivideByConstantNode* node) = 0;
+    virtual void visit(ShiftLeftNode* node) = 0;
+    // Superinstructions default to the generic node they were fused from.
+    virtual void visit(IncrementNode* node);
+    virtual void visit(AddVariablesNode* node);
+    virtual void visit(CompareConstantIfNode* node);
+    virtual void visit(CompareConstantWhileNode* node);
+    //Only the Interpreter runs lazy bodies. The Optimizer leaves statements holding one alone, so no pass should reach one.
+    virtual void visit(LazyBodyNode* node);
     virtual ~ASTVisitor() = default;
 };
 
+// Visitor interface for expression nodes, returning the expression's value directly
+class ExpressionVisitor {
+public:
+    virtual int evaluate(BinaryOpNode* node) = 0;
+    virtual int evaluate(NumberNode* node) = 0;
+    virtual int evaluate(VariableNode* node) = 0;
+    virtual int evaluate(ComparisonNode* node) = 0;
+    virtual int evaluate(LogicalOpNode* node) = 0;
+    virtual int evaluate(DivideByConstantNode* node) = 0;
+    virtual int evaluate(ShiftLeftNode* node) = 0;
+    virtual ~ExpressionVisitor() = default;
+};
+
 // Base AST node class
 class AST {
 public:
+    //The source line a statement starts on, for traces. Expressions and nodes created by the optimizer without a source keep 0.
+    int line = 0;
+
     virtual ~AST() = default;
     virtual void accept(ASTVisitor& visitor) = 0;
+    //Only expression nodes have a value; the parser never puts a statement where an expression is expected.
+    virtual int evaluate(ExpressionVisitor&) {
+        throw std::runtime_error("Statement used as an expression");
+    }
 };
 
 // Node implementations
@@ -243,6 +885,25 @@ public:
     TokenType op;
     std::unique_ptr<AST> left;
     std::unique_ptr<AST> right;
+    //Cleared by RangeAnalysis when a division can never divide by zero or overflow.
+    bool checkDivisor = true;
+
+    /*
+    Quickening state, owned by the Interpreter. On first execution the node picks a handler specialized for its operator and operand
+    shapes; the handler returns false when one of its assumptions breaks, and the node then falls back to the generic path for good.
+    A handler that fails after evaluating operands hands them over in Evaluated, so the generic path doesn't evaluate them again.
+    */
+    struct Evaluated {
+        int left = 0;
+        int right = 0;
+        //How many operands, left first, have been evaluated.
+        int count = 0;
+    };
+    using QuickHandler = bool (*)(Interpreter& interpreter, BinaryOpNode* node, int& result, Evaluated& evaluated);
+    QuickHandler quickened = nullptr;
+    bool generic = false;
+    size_t leftSlot = 0;
+    size_t rightSlot = 0;
 
     BinaryOpNode(TokenType op_, std::unique_ptr<AST> left_, std::unique_ptr<AST> right_)
         : op(op_), left(std::move(left_)), right(std::move(right_)) {}
@@ -250,6 +911,10 @@ public:
     void accept(ASTVisitor& visitor) override {
         visitor.visit(this);
     }
+
+    int evaluate(ExpressionVisitor& visitor) override {
+        return visitor.evaluate(this);
+    }
 };
 
 // Node for integer values
@@ -262,18 +927,30 @@ public:
     void accept(ASTVisitor& visitor) override {
         visitor.visit(this);
     }
+
+    int evaluate(ExpressionVisitor& visitor) override {
+        return visitor.evaluate(this);
+    }
 };
 
 // Node for variables (identifiers)
 class VariableNode : public AST {
 public:
     std::string name;
+    //Cleared by RangeAnalysis when the variable is always defined at this read.
+    bool checkDefined = true;
+    //Resolved by the Interpreter on first execution.
+    std::optional<size_t> slot;
 
     explicit VariableNode(std::string name_) : name(std::move(name_)) {}
 
     void accept(ASTVisitor& visitor) override {
         visitor.visit(this);
     }
+
+    int evaluate(ExpressionVisitor& visitor) override {
+        return visitor.evaluate(this);
+    }
 };
 
 // Node for assignment statements (variable = expression)
@@ -281,6 +958,8 @@ class AssignNode : public AST {
 public:
     std::string name;
     std::unique_ptr<AST> value;
+    //Resolved by the Interpreter on first execution.
+    std::optional<size_t> target;
 
     AssignNode(std::string name_, std::unique_ptr<AST> value_)
         : name(std::move(name_)), value(std::move(value_)) {}
@@ -316,6 +995,10 @@ public:
     void accept(ASTVisitor& visitor) override {
         visitor.visit(this);
     }
+
+    int evaluate(ExpressionVisitor& visitor) override {
+        return visitor.evaluate(this);
+    }
 };
 
 // Node for logical operations (AND, OR)
@@ -325,19 +1008,42 @@ public:
     std::unique_ptr<AST> left;
     std::unique_ptr<AST> right;
 
+    /*
+    Set by ConditionReordering when neither operand can fail or have side effects, so the Interpreter may evaluate them in either order.
+    It then profiles the node's first evaluations, evaluating both operands to see how often each decides the result alone, and puts
+    the operand with the lower expected cost first. The costs are operand sizes in nodes.
+    */
+    bool reorderable = false;
+    //Set by RangeAnalysis when the right operand only avoids a check because the left one runs first, which rules out reordering.
+    bool rightNeedsLeft = false;
+    int leftCost = 0;
+    int rightCost = 0;
+    int profiled = 0;
+    int leftDecides = 0;
+    int rightDecides = 0;
+
     LogicalOpNode(TokenType op_, std::unique_ptr<AST> left_, std::unique_ptr<AST> right_)
         : op(op_), left(std::move(left_)), right(std::move(right_)) {}
 
     void accept(ASTVisitor& visitor) override {
         visitor.visit(this);
     }
+
+    int evaluate(ExpressionVisitor& visitor) override {
+        return visitor.evaluate(this);
+    }
 };
 
+struct BranchProgram;
+struct LoopProfile;
+
 // Node for if statements
 class IfNode : public AST {
 public:
     std::unique_ptr<AST> condition;
     std::vector<std::unique_ptr<AST>> body;
+    //The condition in compare-and-jump form, compiled by the Interpreter on first use.
+    std::shared_ptr<const BranchProgram> branches;
 
     IfNode(std::unique_ptr<AST> condition_, std::vector<std::unique_ptr<AST>> body_)
         : condition(std::move(condition_)), body(std::move(body_)) {}
@@ -352,6 +1058,13 @@ class WhileNode : public AST {
 public:
     std::unique_ptr<AST> condition;
     std::vector<std::unique_ptr<AST>> body;
+    //The condition in compare-and-jump form, compiled by the Interpreter on first use.
+    std::shared_ptr<const BranchProgram> branches;
+    //Where the Interpreter counts this loop's runs under --loop-stats.
+    LoopProfile* profile = nullptr;
+    //Under --tiered: the iterations the Interpreter has run of this loop as parsed, and the optimized copy that runs once it is hot.
+    uint64_t iterations = 0;
+    std::unique_ptr<AST> compiled;
 
     WhileNode(std::unique_ptr<AST> condition_, std::vector<std::unique_ptr<AST>> body_)
         : condition(std::move(condition_)), body(std::move(body_)) {}
@@ -361,13 +1074,43 @@ public:
     }
 };
 
+struct ReductionKernel;
+
 // Node for for loops
 class ForNode : public AST {
 public:
+    //A hidden variable that always holds var_name * factor, maintained by additions instead of multiplications.
+    struct DerivedInduction {
+        std::string name;
+        int factor;
+    };
+
     std::string var_name;
     std::unique_ptr<AST> start;
     std::unique_ptr<AST> end;
     std::vector<std::unique_ptr<AST>> body;
+    std::vector<DerivedInduction> derived;
+    /*
+    Set by CountedLoops for a while loop rewritten into this form. The counter starts at 'start', steps by 'step' with wrapping
+    arithmetic for as long as 'counter test end' holds, and the loop variable is left at the first value that fails the test.
+    */
+    bool countedWhile = false;
+    TokenType test = LESS_THAN_OR_EQUAL_TO;
+    int step = 1;
+    //Set by PartialUnrolling: unrolledBody is 'unroll' copies of body, copy j reading the induction variables at iteration i + j * step.
+    int unroll = 1;
+    std::vector<std::unique_ptr<AST>> unrolledBody;
+    //Set by ReductionVectorizer when the whole body can run as a reduction kernel instead.
+    std::shared_ptr<const ReductionKernel> reduction;
+    //Scratch space owned by the Interpreter and kept between runs of the loop, so running it again doesn't allocate. A loop never runs inside itself.
+    std::vector<size_t> derivedSlots;
+    std::vector<int> derivedValues;
+    std::vector<int> invariantValues;
+    //Where the Interpreter counts this loop's runs under --loop-stats.
+    LoopProfile* profile = nullptr;
+    //Under --tiered: the iterations the Interpreter has run of this loop as parsed, and the optimized copy that runs once it is hot.
+    uint64_t iterations = 0;
+    std::unique_ptr<AST> compiled;
 
     ForNode(std::string var_name_, std::unique_ptr<AST> start_, std::unique_ptr<AST> end_,
             std::vector<std::unique_ptr<AST>> body_)
@@ -379,396 +1122,6395 @@ public:
     }
 };
 
-// Interpreter class
-class Interpreter : public ASTVisitor {
-private:
-    SymbolTable& symbolTable;
-    std::optional<int> lastValue;
+/*
+Magic multiplier and shift for dividing a 32-bit integer by a constant, following Hacker's Delight (10-1).
+n / d == high 32 bits of (multiplier * n), corrected by n when the multiplier's sign disagrees with d, arithmetically shifted right by 'shift',
+plus one if that result is negative. This matches C++ truncation toward zero for every n, including negative ones.
+*/
+struct DivisionMagic {
+    int multiplier;
+    int shift;
+};
+
+inline DivisionMagic compute_division_magic(int divisor) {
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = divisor < 0 ? 0u - static_cast<uint32_t>(divisor) : static_cast<uint32_t>(divisor);
+    uint32_t t = two31 + (static_cast<uint32_t>(divisor) >> 31);
+    uint32_t anc = t - 1 - t % ad;
+    int p = 31;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    uint32_t multiplier = q2 + 1;
+    if (divisor < 0) multiplier = 0u - multiplier;
+    return {static_cast<int>(multiplier), p - 32};
+}
+
+inline int magic_divide(int n, int divisor, DivisionMagic magic) {
+    int q = static_cast<int>((static_cast<int64_t>(magic.multiplier) * n) >> 32);
+    if (divisor > 0 && magic.multiplier < 0) q = wrapping_add(q, n);
+    if (divisor < 0 && magic.multiplier > 0) q = wrapping_sub(q, n);
+    q >>= magic.shift;
+    return q + static_cast<int>(static_cast<uint32_t>(q) >> 31);
+}
 
+// Node for division by a constant with |divisor| >= 2, evaluated with a multiply and shifts instead of a hardware divide
+class DivideByConstantNode : public AST {
 public:
-    explicit Interpreter(SymbolTable& symbolTable_) : symbolTable(symbolTable_) {}
+    std::unique_ptr<AST> left;
+    int divisor;
+    DivisionMagic magic;
 
-    void visit(BinaryOpNode* node) override {
-        node->left->accept(*this);
-        int left = lastValue.value();
-        node->right->accept(*this);
-        int right = lastValue.value();
+    DivideByConstantNode(std::unique_ptr<AST> left_, int divisor_)
+        : left(std::move(left_)), divisor(divisor_), magic(compute_division_magic(divisor_)) {}
 
-        switch (node->op) {
-            case PLUS:
-                lastValue = left + right;
-                break;
-            case MINUS:
-                lastValue = left - right;
-                break;
-            case MUL:
-                lastValue = left * right;
-                break;
-            case DIV:
-                if (right == 0) throw std::runtime_error("Division by zero");
-                lastValue = left / right;
-                break;
-            default:
-                throw std::runtime_error("Invalid binary operator");
-        }
+    int divide(int n) const {
+        return magic_divide(n, divisor, magic);
     }
 
-    //Visits a NumberNode and stores its value in the lastValue variable.
-    void visit(NumberNode* node) override {
-        lastValue = node->value;
+    void accept(ASTVisitor& visitor) override {
+        visitor.visit(this);
     }
 
-    //Visits a VariableNode and retrieves its value from the symbol table. If the variable is not found, it will throw a runtime error.
-    void visit(VariableNode* node) override {
-        auto entry = symbolTable.get(node->name);
-        if (!entry) {
-            throw std::runtime_error("Undefined variable: " + node->name);
-        }
-        lastValue = std::stoi(entry->value);
+    int evaluate(ExpressionVisitor& visitor) override {
+        return visitor.evaluate(this);
     }
+};
 
-    //Visits an AssignNode, evaluates the expression on the right side of the assignment, and stores the result in the symbol table.
-    void visit(AssignNode* node) override {
-        node->value->accept(*this);
-        symbolTable.addOrUpdate(node->name, "INTEGER", std::to_string(lastValue.value()));
+// Node for multiplication by a power of two
+class ShiftLeftNode : public AST {
+public:
+    std::unique_ptr<AST> left;
+    int shift;
+
+    ShiftLeftNode(std::unique_ptr<AST> left_, int shift_) : left(std::move(left_)), shift(shift_) {}
+
+    void accept(ASTVisitor& visitor) override {
+        visitor.visit(this);
     }
 
-    //Visits a PrintNode, evaluates each expression in the print statement, and prints the result to the console.
+    int evaluate(ExpressionVisitor& visitor) override {
+        return visitor.evaluate(this);
+    }
+};
+
+/*
+Superinstructions, produced by the Superinstructions pass from the most common statement shapes. Each one is still the generic node it
+was fused from (with the original children intact) so passes and engines that don't know it fall back to the generic visit, but it also
+caches the variable slots and constants it needs so the Interpreter can execute it in a single dispatch.
+*/
+
+// Node for x = x + K and x = x - K (delta is K or -K)
+class IncrementNode : public AssignNode {
+public:
+    size_t slot;
+    int delta;
+    bool checkDefined;
+
+    IncrementNode(AssignNode&& generic, size_t slot_, int delta_, bool checkDefined_)
+        : AssignNode(std::move(generic.name), std::move(generic.value)), slot(slot_), delta(delta_), checkDefined(checkDefined_) {
+        line = generic.line;
+    }
+
+    void accept(ASTVisitor& visitor) override {
+        visitor.visit(this);
+    }
+};
+
+// Node for x = y + z, where y and z are variables
+class AddVariablesNode : public AssignNode {
+public:
+    size_t slot;
+    size_t leftSlot;
+    size_t rightSlot;
+    bool checkLeft;
+    bool checkRight;
+
+    AddVariablesNode(AssignNode&& generic, size_t slot_, size_t leftSlot_, size_t rightSlot_, bool checkLeft_, bool checkRight_)
+        : AssignNode(std::move(generic.name), std::move(generic.value)), slot(slot_), leftSlot(leftSlot_), rightSlot(rightSlot_),
+          checkLeft(checkLeft_), checkRight(checkRight_) {
+        line = generic.line;
+    }
+
+    void accept(ASTVisitor& visitor) override {
+        visitor.visit(this);
+    }
+};
+
+//The cached form of a 'variable op constant' condition shared by the compare-and-branch superinstructions.
+struct VariableConstantTest {
+    size_t slot;
+    TokenType op;
+    int constant;
+    bool checkDefined;
+};
+
+// Node for if v op K then
+class CompareConstantIfNode : public IfNode {
+public:
+    VariableConstantTest test;
+
+    CompareConstantIfNode(IfNode&& generic, VariableConstantTest test_)
+        : IfNode(std::move(generic.condition), std::move(generic.body)), test(test_) {
+        line = generic.line;
+    }
+
+    void accept(ASTVisitor& visitor) override {
+        visitor.visit(this);
+    }
+};
+
+// Node for while v op K then
+class CompareConstantWhileNode : public WhileNode {
+public:
+    VariableConstantTest test;
+
+    CompareConstantWhileNode(WhileNode&& generic, VariableConstantTest test_)
+        : WhileNode(std::move(generic.condition), std::move(generic.body)), test(test_) {
+        line = generic.line;
+    }
+
+    void accept(ASTVisitor& visitor) override {
+        visitor.visit(this);
+    }
+};
+
+/*
+The source a Parser in lazy mode skipped bodies of, which outlives the Parser, and what to do with each statement parsed from one of
+those bodies before it runs.
+*/
+struct LazySource {
+    std::shared_ptr<const std::string> text;
+    SymbolTable& symbolTable;
+    std::function<void(std::unique_ptr<AST>&)> prepare;
+    //Where each if body inside a skipped body starts in 'text', mapped to where its END is and the line of that END. The first scan
+    //finds them, so parsing a skipped body later jumps over the bodies nested in it instead of reading them again.
+    std::unordered_map<size_t, std::pair<size_t, int>> bodyEnds;
+};
+
+/*
+The body of an if statement that a Parser in lazy mode only skip-scanned: where its statements are in the source, and the locals in
+scope there. It is the only statement of the IfNode's body. The first time the Interpreter runs it, parse() builds its statements, so a
+body that never runs costs no more than its tokens.
+*/
+class LazyBodyNode : public AST {
+public:
+    std::shared_ptr<LazySource> source;
+    size_t start;
+    size_t end;
+    int firstLine;
+    //Each local in scope at the start of the body and its frame slot, the first free frame slot, and the blocks around the body.
+    std::unordered_map<std::string, std::string> locals;
+    size_t frameSize;
+    size_t outerBlocks;
+    bool parsed = false;
+    std::vector<std::unique_ptr<AST>> body;
+
+    LazyBodyNode(std::shared_ptr<LazySource> source_, size_t start_, size_t end_, int firstLine_,
+                 std::unordered_map<std::string, std::string> locals_, size_t frameSize_, size_t outerBlocks_)
+        : source(std::move(source_)), start(start_), end(end_), firstLine(firstLine_), locals(std::move(locals_)),
+          frameSize(frameSize_), outerBlocks(outerBlocks_) {}
+
+    //Parses the body and prepares its statements, once. Throws the syntax errors the parser would have reported for the body.
+    void parse();
+
+    void accept(ASTVisitor& visitor) override {
+        visitor.visit(this);
+    }
+};
+
+inline void ASTVisitor::visit(LazyBodyNode*) {
+    throw std::runtime_error("Unparsed lazy body in an optimization pass");
+}
+
+inline void ASTVisitor::visit(IncrementNode* node) {
+    visit(static_cast<AssignNode*>(node));
+}
+
+inline void ASTVisitor::visit(AddVariablesNode* node) {
+    visit(static_cast<AssignNode*>(node));
+}
+
+inline void ASTVisitor::visit(CompareConstantIfNode* node) {
+    visit(static_cast<IfNode*>(node));
+}
+
+inline void ASTVisitor::visit(CompareConstantWhileNode* node) {
+    visit(static_cast<WhileNode*>(node));
+}
+
+inline bool compare_values(TokenType op, int left, int right) {
+    switch (op) {
+        case EQUAL_TO: return left == right;
+        case NOT_EQUAL_TO: return left != right;
+        case GREATER_THAN: return left > right;
+        case LESS_THAN: return left < right;
+        case GREATER_THAN_OR_EQUAL_TO: return left >= right;
+        case LESS_THAN_OR_EQUAL_TO: return left <= right;
+        default: throw std::runtime_error("Invalid comparison operator");
+    }
+}
+
+/*
+A condition compiled into compare-and-jump form. Each test compares two operands and jumps to the next test to run, or out of the
+condition, depending on the outcome, so and/or short-circuit through the jump targets instead of materializing booleans that the
+enclosing node tests again. A literal right operand is kept as an immediate, and a leaf that isn't a comparison tests its value against 0.
+*/
+struct BranchProgram {
+    static constexpr int exitTrue = -1;
+    static constexpr int exitFalse = -2;
+
+    struct Test {
+        AST* left;
+        AST* right; //nullptr when the right operand is the immediate
+        int immediate;
+        TokenType op;
+        int onTrue;
+        int onFalse;
+    };
+
+    std::vector<Test> tests;
+
+    //Compiles a condition, or returns nullptr while one of its and/or nodes is still being profiled for reordering.
+    static std::shared_ptr<const BranchProgram> compile(AST* condition) {
+        if (!compilable(condition)) return nullptr;
+        auto program = std::make_shared<BranchProgram>();
+        program->emit(condition, exitTrue, exitFalse);
+        return program;
+    }
+
+private:
+    static bool compilable(AST* node) {
+        auto logical = dynamic_cast<LogicalOpNode*>(node);
+        if (!logical) return true;
+        return !logical->reorderable && compilable(logical->left.get()) && compilable(logical->right.get());
+    }
+
+    static int leaves(AST* node) {
+        auto logical = dynamic_cast<LogicalOpNode*>(node);
+        if (!logical) return 1;
+        return leaves(logical->left.get()) + leaves(logical->right.get());
+    }
+
+    //Every leaf emits one test, so the right operand of an and/or starts right after the left operand's leaves.
+    void emit(AST* node, int onTrue, int onFalse) {
+        if (auto logical = dynamic_cast<LogicalOpNode*>(node)) {
+            int right = static_cast<int>(tests.size()) + leaves(logical->left.get());
+            if (logical->op == AND) {
+                emit(logical->left.get(), right, onFalse);
+            } else {
+                emit(logical->left.get(), onTrue, right);
+            }
+            emit(logical->right.get(), onTrue, onFalse);
+            return;
+        }
+        if (auto comparison = dynamic_cast<ComparisonNode*>(node)) {
+            if (auto number = dynamic_cast<NumberNode*>(comparison->right.get())) {
+                tests.push_back({comparison->left.get(), nullptr, number->value, comparison->op, onTrue, onFalse});
+            } else {
+                tests.push_back({comparison->left.get(), comparison->right.get(), 0, comparison->op, onTrue, onFalse});
+            }
+            return;
+        }
+        tests.push_back({node, nullptr, 0, NOT_EQUAL_TO, onTrue, onFalse});
+    }
+};
+
+/*
+A for loop whose body only folds arithmetic on its counter into one accumulator:
+    acc = a sum of acc and other terms (acc + E, E + acc, acc + a - b, ...), optionally inside 'if C then ... end'
+The other terms, E, and the condition C are compiled into a flat list of lane operations, so the loop can run without walking the tree: 8 iterations at a time in AVX2
+lanes when the CPU has them, and one at a time otherwise. Addition is associative and commutative modulo 2^32, so adding up the lanes
+separately and reducing them at the end gives exactly the wrapped result of the scalar loop. Conditions are lane masks of 0 or -1.
+*/
+struct ReductionKernel {
+    enum class Op { Counter, Constant, Invariant, Add, Sub, Mul, Shl, Compare, And, Or, NotZero };
+
+    struct Instr {
+        Op op;
+        int a = 0;
+        int b = 0;
+        int imm = 0;
+        TokenType compare = EQUAL_TO;
+    };
+
+    static constexpr size_t maxInstrs = 32;
+    std::vector<Instr> code;
+    int value = -1;
+    int guard = -1;
+    size_t accumulator = 0;
+    //Slots of the loop-invariant variables read by E and C. Op::Invariant's 'imm' indexes this list.
+    std::vector<size_t> invariants;
+
+    //Evaluates one iteration.
+    int evaluate(int counter, const std::vector<int>& invariantValues) const {
+        int regs[maxInstrs] = {};
+        for (size_t n = 0; n < code.size(); n++) {
+            const Instr& in = code[n];
+            switch (in.op) {
+                case Op::Counter: regs[n] = counter; break;
+                case Op::Constant: regs[n] = in.imm; break;
+                case Op::Invariant: regs[n] = invariantValues[in.imm]; break;
+                case Op::Add: regs[n] = wrapping_add(regs[in.a], regs[in.b]); break;
+                case Op::Sub: regs[n] = wrapping_sub(regs[in.a], regs[in.b]); break;
+                case Op::Mul: regs[n] = wrapping_mul(regs[in.a], regs[in.b]); break;
+                case Op::Shl: regs[n] = static_cast<int>(static_cast<uint32_t>(regs[in.a]) << in.imm); break;
+                case Op::Compare: regs[n] = compare_values(in.compare, regs[in.a], regs[in.b]) ? -1 : 0; break;
+                case Op::And: regs[n] = regs[in.a] & regs[in.b]; break;
+                case Op::Or: regs[n] = regs[in.a] | regs[in.b]; break;
+                case Op::NotZero: regs[n] = regs[in.a] != 0 ? -1 : 0; break;
+            }
+        }
+        return guard >= 0 ? regs[value] & regs[guard] : regs[value];
+    }
+};
+
+#ifdef KLANG_AVX2
+__attribute__((target("avx2"))) inline __m256i compare_lanes(TokenType op, __m256i a, __m256i b) {
+    const __m256i ones = _mm256_set1_epi32(-1);
+    switch (op) {
+        case EQUAL_TO: return _mm256_cmpeq_epi32(a, b);
+        case NOT_EQUAL_TO: return _mm256_xor_si256(_mm256_cmpeq_epi32(a, b), ones);
+        case GREATER_THAN: return _mm256_cmpgt_epi32(a, b);
+        case LESS_THAN: return _mm256_cmpgt_epi32(b, a);
+        case GREATER_THAN_OR_EQUAL_TO: return _mm256_xor_si256(_mm256_cmpgt_epi32(b, a), ones);
+        default: return _mm256_xor_si256(_mm256_cmpgt_epi32(a, b), ones);
+    }
+}
+
+//Runs iterations k, k + 1, ... of the kernel 8 at a time while 8 remain, and returns their wrapped sum. Leaves k at the first one not run.
+__attribute__((target("avx2"))) inline uint32_t reduce_avx2(const ReductionKernel& kernel, const std::vector<int>& invariantValues,
+                                                           int start, int step, int64_t& k, int64_t trips) {
+    __m256i regs[ReductionKernel::maxInstrs] = {};
+    const auto& code = kernel.code;
+    for (size_t n = 0; n < code.size(); n++) {
+        if (code[n].op == ReductionKernel::Op::Constant) regs[n] = _mm256_set1_epi32(code[n].imm);
+        if (code[n].op == ReductionKernel::Op::Invariant) regs[n] = _mm256_set1_epi32(invariantValues[code[n].imm]);
+    }
+
+    int first = wrapping_add(start, wrapping_mul(static_cast<int>(k), step));
+    __m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(step));
+    __m256i counter = _mm256_add_epi32(_mm256_set1_epi32(first), lanes);
+    const __m256i advance = _mm256_set1_epi32(wrapping_mul(step, 8));
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+
+    for (; k + 8 <= trips; k += 8) {
+        for (size_t n = 0; n < code.size(); n++) {
+            const ReductionKernel::Instr& in = code[n];
+            switch (in.op) {
+                case ReductionKernel::Op::Counter: regs[n] = counter; break;
+                case ReductionKernel::Op::Constant:
+                case ReductionKernel::Op::Invariant: break;
+                case ReductionKernel::Op::Add: regs[n] = _mm256_add_epi32(regs[in.a], regs[in.b]); break;
+                case ReductionKernel::Op::Sub: regs[n] = _mm256_sub_epi32(regs[in.a], regs[in.b]); break;
+                case ReductionKernel::Op::Mul: regs[n] = _mm256_mullo_epi32(regs[in.a], regs[in.b]); break;
+                case ReductionKernel::Op::Shl: regs[n] = _mm256_sll_epi32(regs[in.a], _mm_cvtsi32_si128(in.imm)); break;
+                case ReductionKernel::Op::Compare: regs[n] = compare_lanes(in.compare, regs[in.a], regs[in.b]); break;
+                case ReductionKernel::Op::And: regs[n] = _mm256_and_si256(regs[in.a], regs[in.b]); break;
+                case ReductionKernel::Op::Or: regs[n] = _mm256_or_si256(regs[in.a], regs[in.b]); break;
+                case ReductionKernel::Op::NotZero: regs[n] = _mm256_xor_si256(_mm256_cmpeq_epi32(regs[in.a], zero), _mm256_set1_epi32(-1)); break;
+            }
+        }
+        __m256i value = regs[kernel.value];
+        if (kernel.guard >= 0) value = _mm256_and_si256(value, regs[kernel.guard]);
+        total = _mm256_add_epi32(total, value);
+        counter = _mm256_add_epi32(counter, advance);
+    }
+
+    alignas(32) uint32_t sums[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), total);
+    uint32_t sum = 0;
+    for (uint32_t lane : sums) sum += lane;
+    return sum;
+}
+#endif
+
+/*
+Tiered execution (--tiered). The Interpreter runs the program as parsed and counts the iterations of each loop; a loop that reaches
+'threshold' of them is compiled into an optimized copy that runs in its place from then on, so code that runs rarely never pays for
+the optimizer. A loop that gets hot while it runs switches to its copy at the end of an iteration.
+*/
+class Tiering {
+public:
+    uint64_t threshold;
+
+    explicit Tiering(uint64_t threshold_) : threshold(threshold_) {}
+    virtual ~Tiering() = default;
+
+    //An optimized copy of a while or for loop, run from the start. 'midRun' is set when the loop is already running.
+    virtual std::unique_ptr<AST> compile(AST* loop, bool midRun) = 0;
+    //An optimized for loop running the iterations of 'loop' that are left, with the counter going from 'next' to 'end'.
+    virtual std::unique_ptr<AST> compile_rest(ForNode* loop, int next, int end) = 0;
+};
+
+// Interpreter class
+class Interpreter : public ASTVisitor, public ExpressionVisitor {
+private:
+    SymbolTable& symbolTable;
+    Printer& printer;
+    Tracer* tracer = nullptr;
+    LoopStats* loopStats = nullptr;
+    Tiering* tiering = nullptr;
+    int loopDepth = 0;
+
+    //Runs code the optimizer produced for a hot loop. It isn't tiered again.
+    void run_compiled(AST* compiled) {
+        struct Restore {
+            Interpreter& interpreter;
+            Tiering* tiering;
+            ~Restore() {
+                interpreter.tiering = tiering;
+            }
+        } restore{*this, std::exchange(tiering, nullptr)};
+        compiled->accept(*this);
+    }
+
+    //Runs the compiled copy of a hot loop, compiling it first if it hasn't been.
+    void run_compiled(AST* loop, std::unique_ptr<AST>& compiled, bool midRun) {
+        if (!compiled) compiled = tiering->compile(loop, midRun);
+        run_compiled(compiled.get());
+    }
+
+    /*
+    Watches one run of a loop: for the trace, if it is one of the two outermost loops running and it runs long, and for --loop-stats.
+    The loop counts its iterations in 'trips' as they complete, so a loop ended by an error is recorded with the iterations it finished.
+    */
+    class LoopMonitor {
+    private:
+        Interpreter& interpreter;
+        const char* name;
+        int line;
+        LoopProfile* profile = nullptr;
+        bool traced;
+        Tracer::Clock::time_point start;
+
+    public:
+        uint64_t trips = 0;
+
+        LoopMonitor(Interpreter& interpreter_, const char* name_, const char* kind, int line_, LoopProfile*& cached)
+            : interpreter(interpreter_), name(name_), line(line_), traced(interpreter_.tracer && interpreter_.loopDepth < 2) {
+            interpreter.loopDepth++;
+            if (interpreter.loopStats) {
+                if (!cached) cached = interpreter.loopStats->profile(line, kind);
+                profile = cached;
+            }
+            if (traced || profile) start = Tracer::now();
+        }
+
+        ~LoopMonitor() {
+            interpreter.loopDepth--;
+            if (!traced && !profile) return;
+            auto end = Tracer::now();
+            if (profile) profile->record(trips, end - start);
+            if (traced && end - start >= Tracer::longLoop) {
+                interpreter.tracer->record(name, "loop", start, end, {{"line", line}});
+            }
+        }
+    };
+
+    int eval(AST* node) {
+        return node->evaluate(*this);
+    }
+
+    int eval(const std::unique_ptr<AST>& node) {
+        return node->evaluate(*this);
+    }
+
+    int read_slot(size_t slot, bool checkDefined) const {
+        if (checkDefined && !symbolTable.defined(slot)) {
+            throw std::runtime_error("Undefined variable: " + symbolTable.name(slot));
+        }
+        return symbolTable.value(slot);
+    }
+
+    bool test(const VariableConstantTest& test) const {
+        return compare_values(test.op, read_slot(test.slot, test.checkDefined), test.constant);
+    }
+
+    /*
+    Runs a loop through its reduction kernel, if the counter never wraps and every variable the kernel reads is defined (otherwise
+    the loop runs normally, reporting the error at the right iteration). Returns false if the loop still needs to run.
+    */
+    bool run_reduction(ForNode* node, int start, int end, size_t varSlot, const std::vector<size_t>& derivedSlots, uint64_t& completed) {
+        const ReductionKernel& kernel = *node->reduction;
+        int64_t step = node->step;
+        int64_t trips;
+        if (!node->countedWhile) {
+            if (end == INT32_MAX) return false;
+            trips = std::max<int64_t>(0, static_cast<int64_t>(end) - start + 1);
+        } else {
+            int64_t last;
+            switch (node->test) {
+                case LESS_THAN_OR_EQUAL_TO: last = end; break;
+                case LESS_THAN: last = static_cast<int64_t>(end) - 1; break;
+                case GREATER_THAN_OR_EQUAL_TO: last = end; break;
+                default: last = static_cast<int64_t>(end) + 1; break;
+            }
+            if (step > 0) {
+                trips = start > last ? 0 : (last - start) / step + 1;
+            } else {
+                trips = start < last ? 0 : (start - last) / -step + 1;
+            }
+            int64_t exit = start + trips * step;
+            if (exit < INT32_MIN || exit > INT32_MAX) return false;
+        }
+
+        if (!symbolTable.defined(kernel.accumulator)) return false;
+        std::vector<int>& invariantValues = node->invariantValues;
+        invariantValues.clear();
+        for (size_t slot : kernel.invariants) {
+            if (!symbolTable.defined(slot)) return false;
+            invariantValues.push_back(symbolTable.value(slot));
+        }
+
+        uint32_t sum = 0;
+        int64_t k = 0;
+#ifdef KLANG_AVX2
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2 && trips >= 8) {
+            sum = reduce_avx2(kernel, invariantValues, start, node->step, k, trips);
+        }
+#endif
+        for (; k < trips; k++) {
+            sum += static_cast<uint32_t>(kernel.evaluate(static_cast<int>(start + k * step), invariantValues));
+        }
+
+        int accumulator = symbolTable.value(kernel.accumulator);
+        int total = static_cast<int>(sum);
+        symbolTable.set(kernel.accumulator, wrapping_add(accumulator, total));
+        if (trips > 0) {
+            int last = static_cast<int>(start + (trips - 1) * step);
+            for (size_t d = 0; d < node->derived.size(); d++) {
+                symbolTable.set(derivedSlots[d], wrapping_mul(last, node->derived[d].factor));
+            }
+            symbolTable.set(varSlot, node->countedWhile ? static_cast<int>(start + trips * step) : end);
+        } else if (node->countedWhile) {
+            symbolTable.set(varSlot, start);
+        }
+        completed = trips;
+        return true;
+    }
+
+    //Runs a while loop rewritten by CountedLoops, with the counter kept here instead of being re-read and re-tested from the tree.
+    void run_counted_while(ForNode* node, int counter, int end, size_t varSlot, const std::vector<size_t>& derivedSlots,
+                           std::vector<int>& derivedValues, uint64_t& trips) {
+        if (node->unroll > 1) {
+            //A chunk runs when its last counter value passes the test without wrapping, so every value before it passes too.
+            int chunkStep = wrapping_mul(node->step, node->unroll);
+            while (true) {
+                int64_t last = static_cast<int64_t>(counter) + static_cast<int64_t>(node->step) * (node->unroll - 1);
+                if (last < INT32_MIN || last > INT32_MAX || !compare_values(node->test, static_cast<int>(last), end)) break;
+                symbolTable.set(varSlot, counter);
+                for (size_t k = 0; k < node->derived.size(); k++) {
+                    symbolTable.set(derivedSlots[k], derivedValues[k]);
+                    derivedValues[k] = wrapping_add(derivedValues[k], wrapping_mul(node->derived[k].factor, chunkStep));
+                }
+                for (const auto& stmt : node->unrolledBody) {
+                    stmt->accept(*this);
+                }
+                trips += node->unroll;
+                counter = wrapping_add(counter, chunkStep);
+            }
+        }
+
+        while (compare_values(node->test, counter, end)) {
+            symbolTable.set(varSlot, counter);
+            for (size_t k = 0; k < node->derived.size(); k++) {
+                symbolTable.set(derivedSlots[k], derivedValues[k]);
+                derivedValues[k] = wrapping_add(derivedValues[k], wrapping_mul(node->derived[k].factor, node->step));
+            }
+            for (const auto& stmt : node->body) {
+                stmt->accept(*this);
+            }
+            trips++;
+            counter = wrapping_add(counter, node->step);
+        }
+        symbolTable.set(varSlot, counter);
+    }
+
+    //The operand shapes a quickened BinaryOpNode can be specialized for.
+    enum class OperandShape { Variable, Constant, Nested };
+
+    //Reads one operand of a quickened node. A variable operand assumes the variable is defined and reports false if it is not.
+    template <OperandShape Shape>
+    bool operand(const std::unique_ptr<AST>& node, size_t slot, int& value) {
+        if constexpr (Shape == OperandShape::Constant) {
+            value = static_cast<NumberNode*>(node.get())->value;
+        } else if constexpr (Shape == OperandShape::Variable) {
+            if (!symbolTable.defined(slot)) return false;
+            value = symbolTable.value(slot);
+        } else {
+            value = eval(node);
+        }
+        return true;
+    }
+
+    //A BinaryOpNode handler specialized for one operator and operand shape. Division assumes a nonzero divisor.
+    template <TokenType Op, OperandShape Left, OperandShape Right>
+    static bool quick_binary(Interpreter& self, BinaryOpNode* node, int& result, BinaryOpNode::Evaluated& evaluated) {
+        int left, right;
+        if (!self.operand<Left>(node->left, node->leftSlot, left)) return false;
+        if (!self.operand<Right>(node->right, node->rightSlot, right)) {
+            evaluated = {left, 0, 1};
+            return false;
+        }
+        if constexpr (Op == PLUS) {
+            result = wrapping_add(left, right);
+        } else if constexpr (Op == MINUS) {
+            result = wrapping_sub(left, right);
+        } else if constexpr (Op == MUL) {
+            result = wrapping_mul(left, right);
+        } else {
+            if (right == 0) {
+                evaluated = {left, right, 2};
+                return false;
+            }
+            result = checked_div(left, right);
+        }
+        return true;
+    }
+
+    template <TokenType Op, OperandShape Left>
+    static BinaryOpNode::QuickHandler select_handler(OperandShape right) {
+        switch (right) {
+            case OperandShape::Variable: return &quick_binary<Op, Left, OperandShape::Variable>;
+            case OperandShape::Constant: return &quick_binary<Op, Left, OperandShape::Constant>;
+            default: return &quick_binary<Op, Left, OperandShape::Nested>;
+        }
+    }
+
+    template <TokenType Op>
+    static BinaryOpNode::QuickHandler select_handler(OperandShape left, OperandShape right) {
+        switch (left) {
+            case OperandShape::Variable: return select_handler<Op, OperandShape::Variable>(right);
+            case OperandShape::Constant: return select_handler<Op, OperandShape::Constant>(right);
+            default: return select_handler<Op, OperandShape::Nested>(right);
+        }
+    }
+
+    OperandShape observe(const std::unique_ptr<AST>& node, size_t& slot) {
+        if (dynamic_cast<NumberNode*>(node.get())) {
+            return OperandShape::Constant;
+        }
+        if (auto variable = dynamic_cast<VariableNode*>(node.get())) {
+            slot = symbolTable.slot(variable->name);
+            return OperandShape::Variable;
+        }
+        return OperandShape::Nested;
+    }
+
+    //Rewrites a BinaryOpNode into the variant for its operator and the shapes of its operands.
+    void quicken(BinaryOpNode* node) {
+        OperandShape left = observe(node->left, node->leftSlot);
+        OperandShape right = observe(node->right, node->rightSlot);
+        switch (node->op) {
+            case PLUS: node->quickened = select_handler<PLUS>(left, right); break;
+            case MINUS: node->quickened = select_handler<MINUS>(left, right); break;
+            case MUL: node->quickened = select_handler<MUL>(left, right); break;
+            case DIV: node->quickened = select_handler<DIV>(left, right); break;
+            default: node->generic = true; break;
+        }
+    }
+
+public:
+    Interpreter(SymbolTable& symbolTable_, Printer& printer_) : symbolTable(symbolTable_), printer(printer_) {}
+
+    void trace(Tracer* tracer_) {
+        tracer = tracer_;
+    }
+
+    void tier(Tiering* tiering_) {
+        tiering = tiering_;
+    }
+
+    void profile_loops(LoopStats* loopStats_) {
+        loopStats = loopStats_;
+    }
+
+    //Evaluates a BinaryOpNode through its quickened handler, quickening it on first execution. If the handler's assumptions don't hold,
+    //the node is despecialized and this execution finishes on the generic path, which also raises any error. The operands the handler
+    //already evaluated are reused rather than evaluated again.
+    int evaluate(BinaryOpNode* node) override {
+        if (!node->quickened && !node->generic) {
+            quicken(node);
+        }
+        BinaryOpNode::Evaluated evaluated;
+        if (node->quickened) {
+            int result;
+            if (node->quickened(*this, node, result, evaluated)) {
+                return result;
+            }
+            node->quickened = nullptr;
+            node->generic = true;
+        }
+
+        int left = evaluated.count > 0 ? evaluated.left : eval(node->left);
+        int right = evaluated.count > 1 ? evaluated.right : eval(node->right);
+
+        switch (node->op) {
+            case PLUS:
+                return wrapping_add(left, right);
+            case MINUS:
+                return wrapping_sub(left, right);
+            case MUL:
+                return wrapping_mul(left, right);
+            case DIV:
+                return node->checkDivisor ? checked_div(left, right) : left / right;
+            default:
+                throw std::runtime_error("Invalid binary operator");
+        }
+    }
+
+    //Evaluates a NumberNode to its value.
+    int evaluate(NumberNode* node) override {
+        return node->value;
+    }
+
+    //Evaluates a VariableNode by reading its slot in the symbol table. If the variable is not defined, it will throw a runtime error.
+    int evaluate(VariableNode* node) override {
+        if (!node->slot) {
+            node->slot = symbolTable.slot(node->name);
+        }
+        return read_slot(*node->slot, node->checkDefined);
+    }
+
+    //Visits an AssignNode, evaluates the expression on the right side of the assignment, and stores the result in the symbol table.
+    void visit(AssignNode* node) override {
+        int value = eval(node->value);
+        if (!node->target) {
+            node->target = symbolTable.slot(node->name);
+        }
+        symbolTable.set(*node->target, value);
+    }
+
+    //Visits a PrintNode, evaluates each expression in the print statement, and prints the result to the console.
     void visit(PrintNode* node) override {
         bool first = true;
         for (const auto& expr : node->expressions) {
-            if (!first) std::cout << " ";
-            expr->accept(*this);
-            std::cout << lastValue.value();
+            if (!first) printer.separator();
+            printer.value(eval(expr));
             first = false;
         }
-        std::cout << std::endl;
+        printer.end();
     }
 
-    //Visits a ComparisonNode, evaluates the left and right expressions, and stores the result of the comparison in the lastValue variable.
-    void visit(ComparisonNode* node) override {
-        node->left->accept(*this);
-        int left = lastValue.value();
-        node->right->accept(*this);
-        int right = lastValue.value();
+    //Evaluates a ComparisonNode used as data, materializing the result as 0 or 1.
+    int evaluate(ComparisonNode* node) override {
+        int left = eval(node->left);
+        int right = eval(node->right);
+        return compare_values(node->op, left, right);
+    }
 
-        switch (node->op) {
-            case EQUAL_TO:
-                lastValue = left == right;
-                break;
-            case NOT_EQUAL_TO:
-                lastValue = left != right;
-                break;
-            case GREATER_THAN:
-                lastValue = left > right;
-                break;
-            case LESS_THAN:
-                lastValue = left < right;
-                break;
-            case GREATER_THAN_OR_EQUAL_TO:
-                lastValue = left >= right;
-                break;
-            case LESS_THAN_OR_EQUAL_TO:
-                lastValue = left <= right;
-                break;
-            default:
-                throw std::runtime_error("Invalid comparison operator");
+    //Evaluates both operands of a reorderable LogicalOpNode and records which of them decided the result, reordering when done.
+    bool profile(LogicalOpNode* node) {
+        static constexpr int profileWindow = 64;
+        bool left = eval(node->left);
+        bool right = eval(node->right);
+        bool decisive = node->op == OR;
+        node->leftDecides += left == decisive;
+        node->rightDecides += right == decisive;
+        bool result = (node->op == AND) ? (left && right) : (left || right);
+
+        if (++node->profiled < profileWindow) return result;
+        // Expected cost of an order, times the window: the first operand always runs, the second only when the first doesn't decide.
+        int64_t leftFirst = int64_t(node->leftCost) * profileWindow + int64_t(profileWindow - node->leftDecides) * node->rightCost;
+        int64_t rightFirst = int64_t(node->rightCost) * profileWindow + int64_t(profileWindow - node->rightDecides) * node->leftCost;
+        if (rightFirst < leftFirst) {
+            std::swap(node->left, node->right);
+            std::swap(node->leftCost, node->rightCost);
+        }
+        node->reorderable = false;
+        return result;
+    }
+
+    //Evaluates a LogicalOpNode, evaluating the right operand only when the left one doesn't decide the result.
+    int evaluate(LogicalOpNode* node) override {
+        if (node->reorderable) {
+            return profile(node);
         }
+        bool left = eval(node->left);
+        if (node->op == AND && !left) return false;
+        if (node->op == OR && left) return true;
+        return static_cast<bool>(eval(node->right));
+    }
+
+    //Runs a compiled condition, jumping from test to test until one of them leaves the condition.
+    bool branch(const BranchProgram& program) {
+        int next = 0;
+        do {
+            const BranchProgram::Test& test = program.tests[next];
+            int left = eval(test.left);
+            int right = test.right ? eval(test.right) : test.immediate;
+            next = compare_values(test.op, left, right) ? test.onTrue : test.onFalse;
+        } while (next >= 0);
+        return next == BranchProgram::exitTrue;
+    }
+
+    //Evaluates the condition of an if or while statement as a branch, compiling it first if it can be.
+    bool condition(AST* condition, std::shared_ptr<const BranchProgram>& branches) {
+        if (!branches) branches = BranchProgram::compile(condition);
+        if (branches) return branch(*branches);
+        return eval(condition);
+    }
+
+    //Visits an IfNode, evaluates the condition
+    void visit(IfNode* node) override {
+        if (condition(node->condition.get(), node->branches)) {
+            for (const auto& stmt : node->body) {
+                stmt->accept(*this);
+            }
+        }
+    }
+
+    //Runs a body the parser skipped, parsing it the first time.
+    void visit(LazyBodyNode* node) override {
+        if (!node->parsed) {
+            node->parse();
+        }
+        for (const auto& stmt : node->body) {
+            stmt->accept(*this);
+        }
+    }
+    //Visits a WhileNode, evaluates the condition
+    void visit(WhileNode* node) override {
+        if (tiering && node->iterations >= tiering->threshold) {
+            run_compiled(node, node->compiled, false);
+            return;
+        }
+        LoopMonitor monitor(*this, "while loop", "while", node->line, node->profile);
+        while (condition(node->condition.get(), node->branches)) {
+            for (const auto& stmt : node->body) {
+                stmt->accept(*this);
+            }
+            monitor.trips++;
+            //All the state of a while loop is in its variables, so the compiled copy carries on by testing the condition again.
+            if (tiering && ++node->iterations >= tiering->threshold) {
+                run_compiled(node, node->compiled, true);
+                return;
+            }
+        }
+    }
+
+    //Visits a ForNode, evaluates the start and end expressions, and iterates over the body of the for loop.
+    void visit(ForNode* node) override {
+        if (tiering && node->iterations >= tiering->threshold) {
+            run_compiled(node, node->compiled, false);
+            return;
+        }
+        LoopMonitor monitor(*this, node->countedWhile ? "while loop" : "for loop", node->countedWhile ? "while" : "for", node->line, node->profile);
+        int start = eval(node->start);
+        int end = eval(node->end);
+
+        size_t varSlot = symbolTable.slot(node->var_name);
+        std::vector<size_t>& derivedSlots = node->derivedSlots;
+        std::vector<int>& derivedValues = node->derivedValues;
+        derivedSlots.clear();
+        derivedValues.clear();
+        for (const auto& d : node->derived) {
+            derivedSlots.push_back(symbolTable.slot(d.name));
+            derivedValues.push_back(wrapping_mul(start, d.factor));
+        }
+
+        if (node->reduction && run_reduction(node, start, end, varSlot, derivedSlots, monitor.trips)) {
+            return;
+        }
+        if (node->countedWhile) {
+            run_counted_while(node, start, end, varSlot, derivedSlots, derivedValues, monitor.trips);
+            return;
+        }
+
+        int i = start;
+        if (node->unroll > 1) {
+            //Whole chunks of 'unroll' iterations run the unrolled body with the loop variables set once, at the chunk's first iteration.
+            int64_t chunk = start;
+            for (; chunk + node->unroll - 1 <= end; chunk += node->unroll) {
+                symbolTable.set(varSlot, static_cast<int>(chunk));
+                for (size_t k = 0; k < node->derived.size(); k++) {
+                    symbolTable.set(derivedSlots[k], derivedValues[k]);
+                    derivedValues[k] = wrapping_add(derivedValues[k], wrapping_mul(node->derived[k].factor, node->unroll));
+                }
+                for (const auto& stmt : node->unrolledBody) {
+                    stmt->accept(*this);
+                }
+                monitor.trips += node->unroll;
+            }
+            if (chunk > start && chunk > end) {
+                symbolTable.set(varSlot, end);
+            }
+            if (chunk > end) return;
+            i = static_cast<int>(chunk);
+        }
+
+        for (; i <= end; i++) {
+            symbolTable.set(varSlot, i);
+            for (size_t k = 0; k < node->derived.size(); k++) {
+                symbolTable.set(derivedSlots[k], derivedValues[k]);
+                derivedValues[k] = wrapping_add(derivedValues[k], node->derived[k].factor);
+            }
+            for (const auto& stmt : node->body) {
+                stmt->accept(*this);
+            }
+            monitor.trips++;
+            //The counter and the end were evaluated on entry, so the iterations left run as a loop between those values.
+            if (tiering && ++node->iterations >= tiering->threshold && i < end) {
+                run_compiled(tiering->compile_rest(node, i + 1, end).get());
+                return;
+            }
+        }
+    }
+
+    //Visits an IncrementNode: one slot read and one slot write, with no child nodes evaluated.
+    void visit(IncrementNode* node) override {
+        symbolTable.set(node->slot, wrapping_add(read_slot(node->slot, node->checkDefined), node->delta));
+    }
+
+    //Visits an AddVariablesNode. The left variable is read first, so an undefined one is reported in the same order as before.
+    void visit(AddVariablesNode* node) override {
+        int left = read_slot(node->leftSlot, node->checkLeft);
+        int right = read_slot(node->rightSlot, node->checkRight);
+        symbolTable.set(node->slot, wrapping_add(left, right));
+    }
+
+    //Visits a CompareConstantIfNode, testing the slot against the constant without materializing the condition.
+    void visit(CompareConstantIfNode* node) override {
+        if (test(node->test)) {
+            for (const auto& stmt : node->body) {
+                stmt->accept(*this);
+            }
+        }
+    }
+
+    //Visits a CompareConstantWhileNode, testing the slot against the constant on every iteration.
+    void visit(CompareConstantWhileNode* node) override {
+        LoopMonitor monitor(*this, "while loop", "while", node->line, node->profile);
+        while (test(node->test)) {
+            for (const auto& stmt : node->body) {
+                stmt->accept(*this);
+            }
+            monitor.trips++;
+        }
+    }
+
+    //Evaluates a DivideByConstantNode. The divisor is known to be nonzero, so no check is needed.
+    int evaluate(DivideByConstantNode* node) override {
+        return node->divide(eval(node->left));
+    }
+
+    //Evaluates a ShiftLeftNode. Shifting the unsigned representation wraps exactly like the multiplication it replaced.
+    int evaluate(ShiftLeftNode* node) override {
+        return static_cast<int>(static_cast<uint32_t>(eval(node->left)) << node->shift);
+    }
+
+    //Expressions are evaluated through the ExpressionVisitor interface. Visiting one as a statement evaluates it for its errors only.
+    void visit(BinaryOpNode* node) override { evaluate(node); }
+    void visit(NumberNode* node) override { evaluate(node); }
+    void visit(VariableNode* node) override { evaluate(node); }
+    void visit(ComparisonNode* node) override { evaluate(node); }
+    void visit(LogicalOpNode* node) override { evaluate(node); }
+    void visit(DivideByConstantNode* node) override { evaluate(node); }
+    void visit(ShiftLeftNode* node) override { evaluate(node); }
+};
+
+class Parser {
+public:
+    //The deepest tree, in levels of expression, that the parser accepts. main sets it from the stack size it runs the program with.
+    static inline size_t depthLimit = SIZE_MAX;
+    /*
+    The stack budgeted per level of expression. The most measured, in a build without compiler optimization, is about 260 bytes per level of
+    expression and 520 per block (two levels), so the budget is about twice that.
+    */
+    static constexpr size_t levelBytes = 512;
+
+private:
+    Lexer lexer;
+    Token current_token;
+    SymbolTable& symbolTable;
+
+    /*
+    The locals of the blocks being parsed, innermost last, mapping each name to its frame slot. A block's locals take the frame slots
+    above those of the blocks around it, and the slots are free for the next block once its 'end' is reached.
+    */
+    std::vector<std::unordered_map<std::string, std::string>> scopes;
+    size_t frameSize = 0;
+    //The frame slots of the locals in scope for each name, innermost last, so a name resolves without searching every open block.
+    std::unordered_map<std::string, std::vector<std::string>> visibleLocals;
+
+    //Returns the variable a name refers to here: the innermost local with that name, or the global.
+    std::string resolve(const std::string& name) const {
+        auto local = visibleLocals.find(name);
+        return local != visibleLocals.end() ? local->second.back() : name;
+    }
+
+    //Set in lazy mode, where the bodies of if statements outside loops are skip-scanned and only parsed when they first run.
+    std::shared_ptr<LazySource> lazySource;
+    //When the parser reads a lazy body: the blocks around it, and where it starts in the program's source.
+    size_t outerBlocks = 0;
+    size_t sourceOffset = 0;
+
+    bool timeLexing = false;
+    Tracer::Clock::duration lexingTime{};
+
+    Token next_token() {
+        if (!timeLexing) return lexer.get_next_token();
+        auto start = Tracer::now();
+        Token token = lexer.get_next_token();
+        lexingTime += Tracer::now() - start;
+        return token;
+    }
+
+    //Consumes the current token if it matches the expected token_type. If not, it will throw a runtime error. 
+    void eat(TokenType token_type) {
+        if (current_token.type == token_type) {
+            current_token = next_token();
+        } else {
+            throw std::runtime_error("Unexpected token: " + current_token.value);
+        }
+    }
+
+    /*
+    The compound statements whose bodies are being parsed, innermost last. statement() keeps them here rather than on the call stack, so
+    nesting blocks only costs heap memory while parsing.
+    */
+    struct OpenBlock {
+        TokenType kind;
+        int line;
+        std::unique_ptr<AST> condition;
+        std::string var_name;
+        std::unique_ptr<AST> start;
+        std::unique_ptr<AST> end;
+        std::vector<std::unique_ptr<AST>> body;
+
+        OpenBlock(TokenType kind_, int line_) : kind(kind_), line(line_) {}
+    };
+    std::vector<OpenBlock> openBlocks;
+    //How many of the open blocks are loops.
+    size_t openLoops = 0;
+
+    //How many levels of expression an open block counts as in check_depth, as the passes recurse through more frames per block.
+    static constexpr size_t blockLevels = 2;
+
+    //Throws if a tree 'depth' levels deep, inside the open blocks, would nest deeper than the passes over the AST may recurse.
+    void check_depth(size_t depth) const {
+        if (depth + (outerBlocks + openBlocks.size()) * blockLevels > depthLimit) {
+            throw std::runtime_error("Program nests too deeply for the stack (raise --stack-size)");
+        }
+    }
+
+    static int precedence(TokenType type) {
+        return type == MUL || type == DIV ? 2 : type == PLUS || type == MINUS ? 1 : 0;
+    }
+
+    /*
+    This method parses an expression: factors, which are integers, variables or expressions in parentheses, joined by + and - and the
+    tighter binding * and /, all left associative. It keeps its operands and pending operators on explicit stacks instead of recursing
+    for every parenthesis, and reports the depth of the tree it built in 'depth'. An LPAREN on the operator stack marks where a
+    parenthesized expression began; its operators are applied when its RPAREN is reached.
+    */
+    std::unique_ptr<AST> expr(size_t& depth) {
+        std::vector<std::pair<std::unique_ptr<AST>, size_t>> operands;
+        std::vector<TokenType> operators;
+
+        auto reduce = [&]() {
+            auto right = std::move(operands.back());
+            operands.pop_back();
+            auto& left = operands.back();
+            size_t nodeDepth = std::max(left.second, right.second) + 1;
+            check_depth(nodeDepth);
+            left.first = std::make_unique<BinaryOpNode>(operators.back(), std::move(left.first), std::move(right.first));
+            left.second = nodeDepth;
+            operators.pop_back();
+        };
+
+        while (true) {
+            while (current_token.type == LPAREN) {
+                eat(LPAREN);
+                operators.push_back(LPAREN);
+            }
+            Token token = current_token;
+            if (token.type == INTEGER) {
+                eat(INTEGER);
+                operands.emplace_back(std::make_unique<NumberNode>(std::stoi(token.value)), 1);
+            } else if (token.type == ID) {
+                eat(ID);
+                operands.emplace_back(std::make_unique<VariableNode>(resolve(token.value)), 1);
+            } else {
+                throw std::runtime_error("Syntax error in factor");
+            }
+
+            //Closes parenthesized expressions until an operator continues one, or until the whole expression has ended.
+            while (precedence(current_token.type) == 0) {
+                while (!operators.empty() && operators.back() != LPAREN) {
+                    reduce();
+                }
+                if (operators.empty()) {
+                    depth = operands.back().second;
+                    return std::move(operands.back().first);
+                }
+                eat(RPAREN);
+                operators.pop_back();
+            }
+            TokenType op = current_token.type;
+            while (!operators.empty() && precedence(operators.back()) >= precedence(op)) {
+                reduce();
+            }
+            eat(op);
+            operators.push_back(op);
+        }
+    }
+
+    std::unique_ptr<AST> expr() {
+        size_t depth;
+        return expr(depth);
+    }
+
+    /*
+    This method parses a simple condition, which is an expression followed by a comparison operator and another expression. 
+    It checks if the current token is a comparison operator. If it is, it consumes the operator and the next expression, creating a ComparisonNode. 
+    It returns a unique pointer to the AST node that represents the condition.
+    */
+    std::unique_ptr<AST> simple_condition(size_t& depth) {
+        size_t leftDepth, rightDepth;
+        auto left = expr(leftDepth);
+        TokenType op = current_token.type;
+        
+        switch(op) {
+            case EQUAL_TO:
+            case NOT_EQUAL_TO:
+            case GREATER_THAN:
+            case LESS_THAN:
+            case GREATER_THAN_OR_EQUAL_TO:
+            case LESS_THAN_OR_EQUAL_TO: {
+                eat(op);
+                auto right = expr(rightDepth);
+                depth = std::max(leftDepth, rightDepth) + 1;
+                check_depth(depth);
+                return std::make_unique<ComparisonNode>(op, std::move(left), std::move(right));
+            }
+            default:
+                throw std::runtime_error("Invalid comparison operator");
+        }
+    }
+
+    /*
+    This method parses a condition in an abstract syntax tree (AST), which can be a simple condition potentially followed by logical AND or OR operations. 
+    It starts by parsing a simple condition and assigns it to the node variable. 
+    Then, while the current token represents a logical AND or OR operator, the method consumes the operator, 
+    creates a new logical operation node LogicalOpNode using std::make_unique, and updates the node by linking it to the newly parsed condition.
+    Finally, it returns a unique pointer to the resulting AST node.
+    */
+    std::unique_ptr<AST> condition() {
+        size_t depth, rightDepth;
+        auto node = simple_condition(depth);
+
+        while (current_token.type == AND || current_token.type == OR) {
+            Token token = current_token;
+            eat(token.type);
+            auto right = simple_condition(rightDepth);
+            depth = std::max(depth, rightDepth) + 1;
+            check_depth(depth);
+            node = std::make_unique<LogicalOpNode>(token.type, std::move(node), std::move(right));
+        }
+        return node;
+    }
+
+    //Starts collecting the body of a compound statement whose header has been parsed, in a new scope for locals.
+    void open_block(OpenBlock block) {
+        if (block.kind != IF) openLoops++;
+        scopes.emplace_back();
+        openBlocks.push_back(std::move(block));
+        check_depth(0);
+    }
+
+    //Consumes the END token of the innermost open block and returns the statement it completes.
+    std::unique_ptr<AST> close_block() {
+        eat(END);
+        for (const auto& [name, slot] : scopes.back()) {
+            auto local = visibleLocals.find(name);
+            local->second.pop_back();
+            if (local->second.empty()) visibleLocals.erase(local);
+        }
+        frameSize -= scopes.back().size();
+        scopes.pop_back();
+        OpenBlock block = std::move(openBlocks.back());
+        openBlocks.pop_back();
+        if (block.kind != IF) openLoops--;
+        std::unique_ptr<AST> node;
+        if (block.kind == IF) {
+            node = std::make_unique<IfNode>(std::move(block.condition), std::move(block.body));
+        } else if (block.kind == WHILE) {
+            node = std::make_unique<WhileNode>(std::move(block.condition), std::move(block.body));
+        } else {
+            node = std::make_unique<ForNode>(std::move(block.var_name), std::move(block.start), std::move(block.end), std::move(block.body));
+        }
+        node->line = block.line;
+        return node;
+    }
+
+    /*
+     This method parses the header of an if statement by consuming the IF token, parsing the associated condition and consuming the THEN token.
+     It then opens the body, whose statements statement() collects until the END token completes an IfNode with the condition and the body.
+    */
+    void if_statement(int line) {
+        eat(IF);
+        OpenBlock block(IF, line);
+        block.condition = condition();
+        if (!lazySource || openLoops > 0) {
+            eat(THEN);
+            open_block(std::move(block));
+            return;
+        }
+
+        // The body starts after THEN. Only its tokens are read, counting nested blocks, up to the END that closes it.
+        size_t start = sourceOffset + lexer.pos;
+        int firstLine = lexer.line;
+        std::unordered_map<std::string, std::string> locals;
+        for (const auto& [name, slots] : visibleLocals) {
+            locals.emplace(name, slots.back());
+        }
+        eat(THEN);
+        size_t end;
+        auto known = lazySource->bodyEnds.find(start);
+        if (known != lazySource->bodyEnds.end()) {
+            end = known->second.first;
+            lexer.pos = end - sourceOffset;
+            lexer.current_char = lexer.text[lexer.pos];
+            lexer.line = known->second.second;
+            current_token = next_token();
+        } else {
+            // The blocks open in the body, each with where its body starts if it is an if whose THEN has been read, or npos.
+            std::vector<std::pair<TokenType, size_t>> nested;
+            while (current_token.type != END || !nested.empty()) {
+                switch (current_token.type) {
+                    case EOF_TOKEN:
+                        throw std::runtime_error("Invalid statement");
+                    case IF:
+                    case FOR:
+                    case WHILE:
+                        nested.emplace_back(current_token.type, std::string::npos);
+                        break;
+                    case THEN:
+                        if (!nested.empty() && nested.back().first == IF) nested.back().second = sourceOffset + lexer.pos;
+                        break;
+                    case END:
+                        // The lexer has just read the three letters of the END.
+                        if (nested.back().first == IF && nested.back().second != std::string::npos) {
+                            lazySource->bodyEnds[nested.back().second] = {sourceOffset + lexer.pos - 3, lexer.line};
+                        }
+                        nested.pop_back();
+                        break;
+                    default:
+                        break;
+                }
+                current_token = next_token();
+            }
+            end = sourceOffset + lexer.pos - 3;
+        }
+        block.body.push_back(std::make_unique<LazyBodyNode>(lazySource, start, end, firstLine, std::move(locals), frameSize,
+                                                            outerBlocks + openBlocks.size() + 1));
+        open_block(std::move(block));
+    }
+
+    /*
+    This method parses the header of a while statement by consuming the WHILE token, parsing the associated condition using the condition() method and consuming the THEN token.
+    It then opens the loop body, whose statements statement() collects until the END token completes a WhileNode with the condition and the loop body.
+    */
+    void while_statement(int line) {
+        eat(WHILE);
+        OpenBlock block(WHILE, line);
+        block.condition = condition();
+        eat(THEN);
+        open_block(std::move(block));
+    }
+
+    /*
+    This method parses the header of a for statement by consuming the FOR token and retrieving the variable name from the current token. 
+    It then consumes the ASSIGN token, parses the start expression, and consumes the TO token to parse the end expression. 
+    Afterward, it opens the body of the for loop, whose statements statement() collects until the END token completes a ForNode with the variable, start expression, end expression, and body.
+    */
+    void for_statement(int line) {
+        eat(FOR);
+        OpenBlock block(FOR, line);
+        block.var_name = resolve(current_token.value);
+        eat(ID);
+        eat(ASSIGN);
+        block.start = expr();
+        eat(TO);
+        block.end = expr();
+        open_block(std::move(block));
+    }
+
+    /*
+    This method parses a print statement by consuming the PRINT token and the left parenthesis, followed by parsing the first expression and adding it to a vector of expressions. 
+    While the current token is a comma, it consumes the comma and parses subsequent expressions, adding each to the vector. 
+    After all expressions are processed, it consumes the right parenthesis and returns a unique pointer to a PrintNode representing the print statement with the list of parsed expressions.
+    */
+    std::unique_ptr<AST> print_statement() {
+        eat(PRINT);
+        eat(LPAREN);
+        std::vector<std::unique_ptr<AST>> expressions;
+        
+        expressions.push_back(expr());
+        while (current_token.type == COMMA) {
+            eat(COMMA);
+            expressions.push_back(expr());
+        }
+        
+        eat(RPAREN);
+        return std::make_unique<PrintNode>(std::move(expressions));
+    }
+
+    /*
+    This method parses an assignment statement in an abstract syntax tree (AST) by retrieving the variable name from the current token and then consuming the ID and ASSIGN tokens. 
+    It subsequently parses the assigned expression and returns a unique pointer to an AssignNode that represents the assignment statement, 
+    linking the variable name to the parsed expression.
+    */
+    std::unique_ptr<AST> assignment_statement() {
+        std::string var_name = resolve(current_token.value);
+        eat(ID);
+        eat(ASSIGN);
+        return std::make_unique<AssignNode>(var_name, expr());
+    }
+
+    /*
+    This method parses a local declaration, 'local x = expression', which is only allowed inside a block. The expression is parsed before x
+    is declared, so it still sees the x of the enclosing scope. Declaring x again in the same block reuses its frame slot.
+    */
+    std::unique_ptr<AST> local_statement() {
+        eat(LOCAL);
+        if (scopes.empty()) {
+            throw std::runtime_error("Local variables can only be declared inside a block");
+        }
+        std::string var_name = current_token.value;
+        eat(ID);
+        eat(ASSIGN);
+        auto value = expr();
+
+        auto& scope = scopes.back();
+        auto local = scope.find(var_name);
+        if (local == scope.end()) {
+            local = scope.emplace(var_name, "$" + std::to_string(frameSize++)).first;
+            visibleLocals[var_name].push_back(local->second);
+        }
+        return std::make_unique<AssignNode>(local->second, std::move(value));
+    }
+
+public:
+    Parser(Lexer lexer_, SymbolTable& symbolTable_) 
+        : lexer(lexer_), current_token(lexer.get_next_token()), symbolTable(symbolTable_) {}
+    
+    TokenType current_token_type() const {
+        return current_token.type;
+    }
+
+    //Makes the parser time the lexer, for traces.
+    void time_lexing() {
+        timeLexing = true;
+    }
+
+    //Puts the parser in lazy mode, where it skips the bodies of if statements outside loops until they first run.
+    void parse_lazily(SymbolTable& symbolTable_, std::function<void(std::unique_ptr<AST>&)> prepare) {
+        lazySource = std::make_shared<LazySource>(LazySource{lexer.source, symbolTable_, std::move(prepare), {}});
+    }
+
+    //Parses the statements of a lazy body, in lazy mode too, with the locals that were in scope where it was skipped.
+    static std::vector<std::unique_ptr<AST>> parse_body(const LazyBodyNode& node) {
+        Parser parser(Lexer(node.source->text, node.start, node.end, node.firstLine), node.source->symbolTable);
+        parser.lazySource = node.source;
+        parser.outerBlocks = node.outerBlocks;
+        parser.sourceOffset = node.start;
+        parser.frameSize = node.frameSize;
+        parser.scopes.emplace_back();
+        for (const auto& [name, slot] : node.locals) {
+            parser.visibleLocals[name].push_back(slot);
+        }
+        std::vector<std::unique_ptr<AST>> body;
+        while (parser.current_token.type != EOF_TOKEN) {
+            body.push_back(parser.statement());
+        }
+        return body;
+    }
+
+    Tracer::Clock::duration lexing_time() const {
+        return lexingTime;
+    }
+
+    /*
+    Parses a statement, which can be if, for, while, assign, local or print. The statements inside if, for and while bodies are parsed
+    by the same loop, with the blocks still open kept in openBlocks, so nesting doesn't recurse.
+    */
+    std::unique_ptr<AST> statement() {
+        openBlocks.clear();
+        openLoops = 0;
+        while (true) {
+            int line = lexer.line;
+            std::unique_ptr<AST> node;
+            switch (current_token.type) {
+                case IF:
+                    if_statement(line);
+                    break;
+                case FOR:
+                    for_statement(line);
+                    break;
+                case WHILE:
+                    while_statement(line);
+                    break;
+                case ID:
+                    node = assignment_statement();
+                    break;
+                case LOCAL:
+                    node = local_statement();
+                    break;
+                case PRINT:
+                    node = print_statement();
+                    break;
+                default:
+                    throw std::runtime_error("Invalid statement");
+            }
+            if (node) {
+                node->line = line;
+                if (openBlocks.empty()) return node;
+                openBlocks.back().body.push_back(std::move(node));
+            }
+            while (!openBlocks.empty() && current_token.type == END) {
+                node = close_block();
+                if (openBlocks.empty()) return node;
+                openBlocks.back().body.push_back(std::move(node));
+            }
+        }
+    }
+};
+
+inline void LazyBodyNode::parse() {
+    body = Parser::parse_body(*this);
+    for (auto& stmt : body) {
+        source->prepare(stmt);
+    }
+    parsed = true;
+}
+
+/*
+Base class for passes that walk or transform the AST. The default visit methods walk into every child.
+A visit method may set 'replacement' to swap the visited node out of its parent.
+*/
+class ASTPass : public ASTVisitor {
+protected:
+    std::unique_ptr<AST> replacement;
+
+public:
+    void run(std::unique_ptr<AST>& node) {
+        node->accept(*this);
+        if (replacement) {
+            node = std::move(replacement);
+        }
+    }
+
+    void run(std::vector<std::unique_ptr<AST>>& nodes) {
+        for (auto& node : nodes) {
+            run(node);
+        }
+    }
+
+    //Runs the pass over a statement list, letting expand() replace each statement with any number of statements.
+    void run_body(std::vector<std::unique_ptr<AST>>& statements) {
+        std::vector<std::unique_ptr<AST>> result;
+        for (auto& statement : statements) {
+            run(statement);
+            if (!expand(statement, result)) {
+                result.push_back(std::move(statement));
+            }
+        }
+        statements = std::move(result);
+    }
+
+    //Appends the statements that replace 'statement' to 'out' and returns true, or returns false to keep it.
+    virtual bool expand(std::unique_ptr<AST>&, std::vector<std::unique_ptr<AST>>&) {
+        return false;
+    }
+
+    void visit(BinaryOpNode* node) override {
+        run(node->left);
+        run(node->right);
+    }
+
+    void visit(NumberNode*) override {}
+
+    void visit(VariableNode*) override {}
+
+    void visit(AssignNode* node) override {
+        run(node->value);
+    }
+
+    void visit(PrintNode* node) override {
+        run(node->expressions);
+    }
+
+    void visit(IfNode* node) override {
+        run(node->condition);
+        run_body(node->body);
+    }
+
+    void visit(WhileNode* node) override {
+        run(node->condition);
+        run_body(node->body);
+    }
+
+    void visit(ForNode* node) override {
+        run(node->start);
+        run(node->end);
+        run_body(node->body);
+        run_body(node->unrolledBody);
+    }
+
+    void visit(ComparisonNode* node) override {
+        run(node->left);
+        run(node->right);
+    }
+
+    void visit(LogicalOpNode* node) override {
+        run(node->left);
+        run(node->right);
+    }
+
+    void visit(DivideByConstantNode* node) override {
+        run(node->left);
+    }
+
+    void visit(ShiftLeftNode* node) override {
+        run(node->left);
+    }
+};
+
+/*
+Deep-copies a subtree, keeping the flags earlier passes set on it. Reads of a variable in 'constants' become that number and reads of a
+variable in 'offsets' become 'variable + offset'.
+*/
+class ASTCloner : public ASTVisitor {
+private:
+    std::unique_ptr<AST> result;
+
+public:
+    std::unordered_map<std::string, int> constants;
+    std::unordered_map<std::string, int> offsets;
+
+    std::unique_ptr<AST> clone(const std::unique_ptr<AST>& node) {
+        return clone(node.get());
+    }
+
+    std::unique_ptr<AST> clone(AST* node) {
+        node->accept(*this);
+        result->line = node->line;
+        return std::move(result);
+    }
+
+    std::vector<std::unique_ptr<AST>> clone(const std::vector<std::unique_ptr<AST>>& nodes) {
+        std::vector<std::unique_ptr<AST>> copies;
+        for (const auto& node : nodes) {
+            copies.push_back(clone(node));
+        }
+        return copies;
+    }
+
+    void visit(BinaryOpNode* node) override {
+        auto copy = std::make_unique<BinaryOpNode>(node->op, clone(node->left), clone(node->right));
+        copy->checkDivisor = node->checkDivisor;
+        result = std::move(copy);
+    }
+
+    void visit(NumberNode* node) override {
+        result = std::make_unique<NumberNode>(node->value);
+    }
+
+    void visit(VariableNode* node) override {
+        if (auto it = constants.find(node->name); it != constants.end()) {
+            result = std::make_unique<NumberNode>(it->second);
+            return;
+        }
+        auto copy = std::make_unique<VariableNode>(node->name);
+        copy->checkDefined = node->checkDefined;
+        auto it = offsets.find(node->name);
+        if (it == offsets.end() || it->second == 0) {
+            result = std::move(copy);
+        } else {
+            result = std::make_unique<BinaryOpNode>(PLUS, std::move(copy), std::make_unique<NumberNode>(it->second));
+        }
+    }
+
+    void visit(AssignNode* node) override {
+        result = std::make_unique<AssignNode>(node->name, clone(node->value));
+    }
+
+    void visit(PrintNode* node) override {
+        result = std::make_unique<PrintNode>(clone(node->expressions));
+    }
+
+    void visit(IfNode* node) override {
+        result = std::make_unique<IfNode>(clone(node->condition), clone(node->body));
+    }
+
+    void visit(WhileNode* node) override {
+        result = std::make_unique<WhileNode>(clone(node->condition), clone(node->body));
+    }
+
+    void visit(ForNode* node) override {
+        auto copy = std::make_unique<ForNode>(node->var_name, clone(node->start), clone(node->end), clone(node->body));
+        copy->derived = node->derived;
+        copy->countedWhile = node->countedWhile;
+        copy->test = node->test;
+        copy->step = node->step;
+        copy->unroll = node->unroll;
+        //A kernel reads its invariants straight from their slots, which would skip the substitutions, so the copy runs its body until
+        //ReductionVectorizer compiles it again.
+        if (constants.empty() && offsets.empty()) {
+            copy->reduction = node->reduction;
+        }
+        copy->unrolledBody = clone(node->unrolledBody);
+        result = std::move(copy);
+    }
+
+    void visit(ComparisonNode* node) override {
+        result = std::make_unique<ComparisonNode>(node->op, clone(node->left), clone(node->right));
+    }
+
+    void visit(LogicalOpNode* node) override {
+        auto copy = std::make_unique<LogicalOpNode>(node->op, clone(node->left), clone(node->right));
+        copy->rightNeedsLeft = node->rightNeedsLeft;
+        result = std::move(copy);
+    }
+
+    void visit(DivideByConstantNode* node) override {
+        result = std::make_unique<DivideByConstantNode>(clone(node->left), node->divisor);
+    }
+
+    void visit(ShiftLeftNode* node) override {
+        result = std::make_unique<ShiftLeftNode>(clone(node->left), node->shift);
+    }
+};
+
+/*
+Counts the nodes ASTCloner would create copying a subtree with no substitutions, to bound code growth without copying it. Stops walking
+once the count passes 'limit', so a pass looking at every loop of a deep nest doesn't walk the whole nest each time.
+*/
+class NodeCount : public ASTVisitor {
+private:
+    int64_t limit;
+
+    void count(const std::unique_ptr<AST>& node) {
+        if (++nodes <= limit) node->accept(*this);
+    }
+
+    void count(const std::vector<std::unique_ptr<AST>>& statements) {
+        for (const auto& statement : statements) {
+            if (exceeded()) return;
+            count(statement);
+        }
+    }
+
+public:
+    int64_t nodes = 0;
+
+    explicit NodeCount(int64_t limit_) : limit(limit_) {}
+
+    //Whether the subtree has more than 'limit' nodes.
+    bool exceeded() const {
+        return nodes > limit;
+    }
+
+    void run(const std::vector<std::unique_ptr<AST>>& statements) {
+        count(statements);
+    }
+
+    void visit(BinaryOpNode* node) override {
+        count(node->left);
+        count(node->right);
+    }
+
+    void visit(NumberNode*) override {}
+
+    void visit(VariableNode*) override {}
+
+    void visit(AssignNode* node) override {
+        count(node->value);
+    }
+
+    void visit(PrintNode* node) override {
+        count(node->expressions);
+    }
+
+    void visit(IfNode* node) override {
+        count(node->condition);
+        count(node->body);
+    }
+
+    void visit(WhileNode* node) override {
+        count(node->condition);
+        count(node->body);
+    }
+
+    void visit(ForNode* node) override {
+        count(node->start);
+        count(node->end);
+        count(node->body);
+        count(node->unrolledBody);
+    }
+
+    void visit(ComparisonNode* node) override {
+        count(node->left);
+        count(node->right);
+    }
+
+    void visit(LogicalOpNode* node) override {
+        count(node->left);
+        count(node->right);
+    }
+
+    void visit(DivideByConstantNode* node) override {
+        count(node->left);
+    }
+
+    void visit(ShiftLeftNode* node) override {
+        count(node->left);
+    }
+};
+
+//Collects the names of every variable a subtree may write, including for loop variables and their derived induction variables.
+class AssignedVariables : public ASTPass {
+public:
+    std::unordered_set<std::string> names;
+
+    void visit(AssignNode* node) override {
+        names.insert(node->name);
+        ASTPass::visit(node);
+    }
+
+    void visit(ForNode* node) override {
+        names.insert(node->var_name);
+        for (const auto& d : node->derived) {
+            names.insert(d.name);
+        }
+        ASTPass::visit(node);
+    }
+};
+
+/*
+Finds, in one walk over a subtree, the for loops whose bodies may write their own loop variable, as AssignedVariables would find by
+walking each loop's body.
+*/
+class CounterWrites : public ASTPass {
+private:
+    //The for loops being walked, by variable, innermost last.
+    std::unordered_map<std::string, std::vector<ForNode*>> open;
+
+    void write(const std::string& name) {
+        auto it = open.find(name);
+        if (it != open.end() && !it->second.empty()) {
+            loops.insert(it->second.back());
+        }
+    }
+
+public:
+    std::unordered_set<ForNode*> loops;
+
+    void visit(AssignNode* node) override {
+        write(node->name);
+        ASTPass::visit(node);
+    }
+
+    void visit(ForNode* node) override {
+        write(node->var_name);
+        for (const auto& d : node->derived) {
+            write(d.name);
+        }
+        std::vector<ForNode*>& outer = open[node->var_name];
+        outer.push_back(node);
+        ASTPass::visit(node);
+        outer.pop_back();
+        // A write in this loop's body is also in the body of the enclosing loop over the same variable.
+        if (!outer.empty() && loops.count(node)) {
+            loops.insert(outer.back());
+        }
+    }
+};
+
+//Collects the names of every variable a subtree reads.
+class ReadVariables : public ASTPass {
+public:
+    std::unordered_set<std::string> names;
+
+    void visit(VariableNode* node) override {
+        names.insert(node->name);
+    }
+};
+
+//Counts what the optimization passes changed. Printed to stderr by --opt-report.
+struct OptimizationStats {
+    int divisionsByConstant = 0;
+    int multiplicationsToShifts = 0;
+    int inductionProducts = 0;
+    int definednessChecks = 0;
+    int definednessChecksRemoved = 0;
+    int divisionChecks = 0;
+    int divisionChecksRemoved = 0;
+    int copiesPropagated = 0;
+    int constantsFolded = 0;
+    int branchesFolded = 0;
+    int blocksRemoved = 0;
+    int increments = 0;
+    int variableAdditions = 0;
+    int compareBranches = 0;
+    int loopsFullyUnrolled = 0;
+    int loopsPartiallyUnrolled = 0;
+    int expressionsFolded = 0;
+    int statementsFolded = 0;
+    int loopsFused = 0;
+    int whileLoopsCounted = 0;
+    int reductionsVectorized = 0;
+    int reorderableConditions = 0;
+    int loopsTieredUp = 0;
+    int onStackReplacements = 0;
+
+    void print(std::ostream& out) const {
+        out << "strength reduction: " << divisionsByConstant << " divisions by constant, "
+            << multiplicationsToShifts << " multiplications to shifts, "
+            << inductionProducts << " induction variable products" << std::endl;
+        out << "range analysis: removed " << definednessChecksRemoved << " of " << definednessChecks << " undefined variable checks, "
+            << divisionChecksRemoved << " of " << divisionChecks << " division checks" << std::endl;
+        out << "ir: " << copiesPropagated << " copies propagated, " << constantsFolded << " constants folded, "
+            << branchesFolded << " branches folded, " << blocksRemoved << " blocks removed" << std::endl;
+        out << "unrolling: " << loopsFullyUnrolled << " loops fully unrolled, " << loopsPartiallyUnrolled << " loops partially unrolled" << std::endl;
+        out << "loop fusion: " << loopsFused << " loops fused, " << whileLoopsCounted << " while loops made counted" << std::endl;
+        out << "constant folding: " << expressionsFolded << " expressions folded, " << statementsFolded << " branches folded" << std::endl;
+        out << "vectorization: " << reductionsVectorized << " reduction loops" << std::endl;
+        out << "condition reordering: " << reorderableConditions << " and/or operators profiled" << std::endl;
+        out << "tiering: " << loopsTieredUp << " loops compiled, " << onStackReplacements << " of them while running" << std::endl;
+        out << "superinstructions: " << increments << " increments, " << variableAdditions << " variable additions, "
+            << compareBranches << " compare-and-branch" << std::endl;
+    }
+};
+
+/*
+Replaces expensive arithmetic with cheaper equivalents:
+- x / K for a nonzero constant K becomes a multiply-and-shift DivideByConstantNode (x / 1 becomes x, x / -1 becomes 0 - x).
+- x * 2^k and 2^k * x become ShiftLeftNodes.
+- i * K inside a for loop over i becomes a read of a hidden derived induction variable that the ForNode advances by K each iteration.
+  This only applies when nothing in the loop body writes i, so i always equals the loop counter there.
+Division by a literal 0 is left alone so it still fails at runtime, only if it is evaluated.
+*/
+class StrengthReduction : public ASTPass {
+private:
+    OptimizationStats& stats;
+    std::vector<ForNode*> inductionLoops;
+    //The loops in the outermost for loop being reduced whose bodies may write their own variable, found once for all of them.
+    std::unordered_set<ForNode*> writtenCounters;
+    int forDepth = 0;
+
+    static std::optional<int> constant(const std::unique_ptr<AST>& node) {
+        if (auto number = dynamic_cast<NumberNode*>(node.get())) {
+            return number->value;
+        }
+        return std::nullopt;
+    }
+
+    ForNode* induction_loop(const std::unique_ptr<AST>& node) const {
+        auto variable = dynamic_cast<VariableNode*>(node.get());
+        if (!variable) return nullptr;
+        for (auto it = inductionLoops.rbegin(); it != inductionLoops.rend(); ++it) {
+            if ((*it)->var_name == variable->name) return *it;
+        }
+        return nullptr;
+    }
+
+    std::string derived_induction(ForNode* loop, int factor) {
+        for (const auto& d : loop->derived) {
+            if (d.factor == factor) return d.name;
+        }
+        // '*' can never appear in an identifier, so the hidden name cannot collide with a user variable.
+        std::string name = loop->var_name + "*" + std::to_string(factor);
+        loop->derived.push_back({name, factor});
+        return name;
+    }
+
+    void reduce_multiplication(BinaryOpNode* node) {
+        std::optional<int> leftConstant = constant(node->left);
+        std::optional<int> rightConstant = constant(node->right);
+        if (!leftConstant && !rightConstant) return;
+
+        int factor = rightConstant ? *rightConstant : *leftConstant;
+        std::unique_ptr<AST>& other = rightConstant ? node->left : node->right;
+
+        if (ForNode* loop = induction_loop(other)) {
+            replacement = std::make_unique<VariableNode>(derived_induction(loop, factor));
+            stats.inductionProducts++;
+            return;
+        }
+
+        uint32_t bits = static_cast<uint32_t>(factor);
+        if (bits == 0 || (bits & (bits - 1)) != 0) return;
+
+        int shift = 0;
+        while ((bits >> shift) != 1) shift++;
+        if (shift == 0) {
+            replacement = std::move(other);
+        } else {
+            replacement = std::make_unique<ShiftLeftNode>(std::move(other), shift);
+        }
+        stats.multiplicationsToShifts++;
+    }
+
+    void reduce_division(BinaryOpNode* node) {
+        std::optional<int> divisor = constant(node->right);
+        if (!divisor || *divisor == 0) return;
+
+        if (*divisor == 1) {
+            replacement = std::move(node->left);
+        } else if (*divisor == -1) {
+            replacement = std::make_unique<BinaryOpNode>(MINUS, std::make_unique<NumberNode>(0), std::move(node->left));
+        } else {
+            replacement = std::make_unique<DivideByConstantNode>(std::move(node->left), *divisor);
+        }
+        stats.divisionsByConstant++;
+    }
+
+public:
+    explicit StrengthReduction(OptimizationStats& stats_) : stats(stats_) {}
+
+    void visit(BinaryOpNode* node) override {
+        ASTPass::visit(node);
+        if (node->op == MUL) {
+            reduce_multiplication(node);
+        } else if (node->op == DIV) {
+            reduce_division(node);
+        }
+    }
+
+    void visit(ForNode* node) override {
+        run(node->start);
+        run(node->end);
+
+        if (forDepth == 0) {
+            CounterWrites writes;
+            node->accept(writes);
+            writtenCounters = std::move(writes.loops);
+        }
+        bool counterOnly = writtenCounters.count(node) == 0;
+
+        forDepth++;
+        if (counterOnly) inductionLoops.push_back(node);
+        run_body(node->body);
+        if (counterOnly) inductionLoops.pop_back();
+        if (--forDepth == 0) writtenCounters.clear();
+    }
+};
+
+//A closed range of values a variable can hold. Bounds are kept in 64 bits so overflow can be detected before it wraps.
+struct Interval {
+    int64_t lo;
+    int64_t hi;
+
+    static Interval top() {
+        return {INT32_MIN, INT32_MAX};
+    }
+
+    //Builds an interval from exact bounds. If either bound is outside the 32-bit range, the operation may wrap and the result can be anything.
+    static Interval of(int64_t lo, int64_t hi) {
+        if (lo < INT32_MIN || hi > INT32_MAX) return top();
+        return {lo, hi};
+    }
+
+    bool contains(int64_t value) const {
+        return lo <= value && value <= hi;
+    }
+
+    bool operator==(const Interval& other) const {
+        return lo == other.lo && hi == other.hi;
+    }
+};
+
+/*
+What the analysis knows about every variable at one program point. A variable missing from 'vars' may be undefined and may hold any value.
+An unreachable state describes a point no execution can get to.
+*/
+struct AbstractState {
+    struct Variable {
+        Interval range;
+        bool defined;
+
+        bool operator==(const Variable& other) const {
+            return range == other.range && defined == other.defined;
+        }
+    };
+
+    bool reachable = true;
+    std::unordered_map<std::string, Variable> vars;
+
+    static AbstractState unreachable() {
+        AbstractState state;
+        state.reachable = false;
+        return state;
+    }
+
+    Interval range(const std::string& name) const {
+        auto it = vars.find(name);
+        return it != vars.end() ? it->second.range : Interval::top();
+    }
+
+    bool defined(const std::string& name) const {
+        auto it = vars.find(name);
+        return it != vars.end() && it->second.defined;
+    }
+
+    bool operator==(const AbstractState& other) const {
+        return reachable == other.reachable && vars == other.vars;
+    }
+
+    //Merges the facts of two control flow paths, keeping only what holds on both.
+    static AbstractState join(const AbstractState& a, const AbstractState& b) {
+        if (!a.reachable) return b;
+        if (!b.reachable) return a;
+        AbstractState result;
+        for (const auto& [name, var] : a.vars) {
+            auto it = b.vars.find(name);
+            if (it == b.vars.end()) continue;
+            Interval range{std::min(var.range.lo, it->second.range.lo), std::max(var.range.hi, it->second.range.hi)};
+            result.vars[name] = {range, var.defined && it->second.defined};
+        }
+        return result;
+    }
+
+    //Like join, but a bound that keeps moving jumps straight to its limit, so loops reach a fixed point quickly.
+    static AbstractState widen(const AbstractState& previous, const AbstractState& next) {
+        AbstractState result = join(previous, next);
+        if (!previous.reachable) return result;
+        for (auto& [name, var] : result.vars) {
+            Interval old = previous.range(name);
+            if (var.range.lo < old.lo) var.range.lo = INT32_MIN;
+            if (var.range.hi > old.hi) var.range.hi = INT32_MAX;
+        }
+        return result;
+    }
+};
+
+//Clears the checks of every analyzed node that never needed them, and counts checks for --opt-report.
+class CheckRemover : public ASTPass {
+private:
+    OptimizationStats& stats;
+    const std::unordered_set<AST*>& visited;
+    const std::unordered_set<AST*>& needsCheck;
+
+    bool removable(AST* node) const {
+        return visited.count(node) && !needsCheck.count(node);
+    }
+
+public:
+    CheckRemover(OptimizationStats& stats_, const std::unordered_set<AST*>& visited_, const std::unordered_set<AST*>& needsCheck_)
+        : stats(stats_), visited(visited_), needsCheck(needsCheck_) {}
+
+    void visit(VariableNode* node) override {
+        stats.definednessChecks++;
+        if (removable(node)) {
+            node->checkDefined = false;
+            stats.definednessChecksRemoved++;
+        }
+    }
+
+    void visit(BinaryOpNode* node) override {
+        ASTPass::visit(node);
+        if (node->op != DIV) return;
+        stats.divisionChecks++;
+        if (removable(node)) {
+            node->checkDivisor = false;
+            stats.divisionChecksRemoved++;
+        }
+    }
+};
+
+/*
+Abstract interpretation over integer intervals and definedness. It follows assignments, narrows ranges through if and while conditions,
+bounds for loop variables by their start and end, and iterates loops to a fixed point (widening after a few rounds).
+It then clears checkDefined on reads whose variable is defined on every path, and checkDivisor on divisions whose divisor can never be 0
+(or -1 when the dividend might be INT_MIN). The state after each top-level statement carries over to the next, so the facts never depend
+on the values a particular run happens to compute.
+*/
+class RangeAnalysis : public ASTVisitor {
+private:
+    OptimizationStats& stats;
+    AbstractState state;
+    Interval lastRange = Interval::top();
+    std::unordered_set<AST*> visited;
+    std::unordered_set<AST*> needsCheck;
+    //Set while alone() analyzes a right operand on its own, so that it doesn't do the same for the operators inside it.
+    bool aloneOperand = false;
+    /*
+    How the last analysis of a loop ended. An enclosing loop analyzes the loop again in each of its rounds, from an entry state that only
+    grows. Starting from the old fixed point 'head' takes a round or two instead of the whole iteration, and when the head already covers
+    the entry, the analysis would end the same way again, so it is skipped. The state the loop exits with is kept as its differences
+    from the head, which are usually a variable or two. Without this, every level of nesting would analyze the loops inside it again.
+    */
+    struct LoopResult {
+        AbstractState head;
+        Interval counter = Interval::top();
+        bool done = false;
+        bool exitReachable = true;
+        std::vector<std::pair<std::string, AbstractState::Variable>> exitChanges;
+    };
+    //The results of the loops inside the outermost loop being analyzed. Nothing analyzes them again once it is done, so they are dropped.
+    std::unordered_map<AST*, LoopResult> loopResults;
+    int loopDepth = 0;
+
+    static constexpr int wideningDelay = 3;
+
+    Interval evaluate(const std::unique_ptr<AST>& node) {
+        node->accept(*this);
+        return lastRange;
+    }
+
+    void execute(const std::vector<std::unique_ptr<AST>>& body) {
+        for (const auto& stmt : body) {
+            if (!state.reachable) return;
+            stmt->accept(*this);
+        }
+    }
+
+    static Interval divide(Interval n, Interval d) {
+        int64_t lo = INT64_MAX, hi = INT64_MIN;
+        auto corner = [&](int64_t a, int64_t b) {
+            lo = std::min(lo, a / b);
+            hi = std::max(hi, a / b);
+        };
+        // Truncating division is monotonic in each operand while the divisor keeps one sign, so the extremes are at the corners.
+        for (Interval part : {Interval{d.lo, std::min<int64_t>(d.hi, -1)}, Interval{std::max<int64_t>(d.lo, 1), d.hi}}) {
+            if (part.lo > part.hi) continue;
+            corner(n.lo, part.lo);
+            corner(n.lo, part.hi);
+            corner(n.hi, part.lo);
+            corner(n.hi, part.hi);
+        }
+        if (lo > hi) return Interval::top();
+        return Interval::of(lo, hi);
+    }
+
+    static Interval multiply(Interval a, Interval b) {
+        int64_t products[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+        return Interval::of(*std::min_element(products, products + 4), *std::max_element(products, products + 4));
+    }
+
+    //Whether 'left op right' holds (truth == true) or fails (truth == false) for at least one pair of values.
+    static bool can_be(TokenType op, Interval left, Interval right, bool truth) {
+        if (!truth) {
+            switch (op) {
+                case EQUAL_TO: op = NOT_EQUAL_TO; break;
+                case NOT_EQUAL_TO: op = EQUAL_TO; break;
+                case GREATER_THAN: op = LESS_THAN_OR_EQUAL_TO; break;
+                case LESS_THAN: op = GREATER_THAN_OR_EQUAL_TO; break;
+                case GREATER_THAN_OR_EQUAL_TO: op = LESS_THAN; break;
+                case LESS_THAN_OR_EQUAL_TO: op = GREATER_THAN; break;
+                default: break;
+            }
+        }
+        switch (op) {
+            case EQUAL_TO: return left.lo <= right.hi && right.lo <= left.hi;
+            case NOT_EQUAL_TO: return !(left.lo == left.hi && right.lo == right.hi && left.lo == right.lo);
+            case GREATER_THAN: return left.hi > right.lo;
+            case LESS_THAN: return left.lo < right.hi;
+            case GREATER_THAN_OR_EQUAL_TO: return left.hi >= right.lo;
+            case LESS_THAN_OR_EQUAL_TO: return left.lo <= right.hi;
+            default: return true;
+        }
+    }
+
+    //Narrows the range of 'node', if it is a variable, to the values for which 'node op other' holds.
+    static void narrow(AbstractState& target, const std::unique_ptr<AST>& node, TokenType op, Interval other) {
+        auto variable = dynamic_cast<VariableNode*>(node.get());
+        if (!variable || !target.reachable) return;
+
+        Interval range = target.range(variable->name);
+        switch (op) {
+            case EQUAL_TO:
+                range = {std::max(range.lo, other.lo), std::min(range.hi, other.hi)};
+                break;
+            case NOT_EQUAL_TO:
+                if (other.lo == other.hi && range.lo == other.lo) range.lo++;
+                else if (other.lo == other.hi && range.hi == other.lo) range.hi--;
+                break;
+            case GREATER_THAN:
+                range.lo = std::max(range.lo, other.lo + 1);
+                break;
+            case LESS_THAN:
+                range.hi = std::min(range.hi, other.hi - 1);
+                break;
+            case GREATER_THAN_OR_EQUAL_TO:
+                range.lo = std::max(range.lo, other.lo);
+                break;
+            case LESS_THAN_OR_EQUAL_TO:
+                range.hi = std::min(range.hi, other.hi);
+                break;
+            default:
+                break;
+        }
+        if (range.lo > range.hi) {
+            target = AbstractState::unreachable();
+            return;
+        }
+        target.vars[variable->name] = {range, true};
+    }
+
+    static TokenType negate(TokenType op) {
+        switch (op) {
+            case EQUAL_TO: return NOT_EQUAL_TO;
+            case NOT_EQUAL_TO: return EQUAL_TO;
+            case GREATER_THAN: return LESS_THAN_OR_EQUAL_TO;
+            case LESS_THAN: return GREATER_THAN_OR_EQUAL_TO;
+            case GREATER_THAN_OR_EQUAL_TO: return LESS_THAN;
+            case LESS_THAN_OR_EQUAL_TO: return GREATER_THAN;
+            default: return op;
+        }
+    }
+
+    //The same comparison with its operands swapped, e.g. a < b becomes b > a.
+    static TokenType mirror(TokenType op) {
+        switch (op) {
+            case GREATER_THAN: return LESS_THAN;
+            case LESS_THAN: return GREATER_THAN;
+            case GREATER_THAN_OR_EQUAL_TO: return LESS_THAN_OR_EQUAL_TO;
+            case LESS_THAN_OR_EQUAL_TO: return GREATER_THAN_OR_EQUAL_TO;
+            default: return op;
+        }
+    }
+
+    /*
+    Analyzes the right operand of 'logical' as if it ran first, from the state 'entry' the operator starts in, and sets rightNeedsLeft
+    if any of its checks would be needed there. What it finds is kept apart from the main analysis, which sees the operand where it runs.
+    */
+    void alone(LogicalOpNode* logical, const AbstractState& entry) {
+        if (aloneOperand) return;
+        AbstractState saved = state;
+        std::unordered_set<AST*> operandVisited, operandNeedsCheck;
+        std::swap(visited, operandVisited);
+        std::swap(needsCheck, operandNeedsCheck);
+        aloneOperand = true;
+        state = entry;
+        branch(logical->right);
+        aloneOperand = false;
+        if (!needsCheck.empty()) logical->rightNeedsLeft = true;
+        std::swap(visited, operandVisited);
+        std::swap(needsCheck, operandNeedsCheck);
+        state = saved;
+    }
+
+    /*
+    Evaluates a condition starting from 'state' and returns the states in which it is true and false.
+    The right operand of 'and'/'or' is only analyzed in the state where short-circuiting lets it run.
+    */
+    std::pair<AbstractState, AbstractState> branch(const std::unique_ptr<AST>& condition) {
+        if (auto logical = dynamic_cast<LogicalOpNode*>(condition.get())) {
+            visited.insert(logical);
+            alone(logical, state);
+            auto [leftTrue, leftFalse] = branch(logical->left);
+            state = logical->op == AND ? leftTrue : leftFalse;
+            if (!state.reachable) {
+                return {leftTrue, leftFalse};
+            }
+            auto [rightTrue, rightFalse] = branch(logical->right);
+            if (logical->op == AND) {
+                return {rightTrue, AbstractState::join(leftFalse, rightFalse)};
+            }
+            return {AbstractState::join(leftTrue, rightTrue), rightFalse};
+        }
+
+        if (auto comparison = dynamic_cast<ComparisonNode*>(condition.get())) {
+            visited.insert(comparison);
+            Interval left = evaluate(comparison->left);
+            Interval right = evaluate(comparison->right);
+            AbstractState whenTrue = can_be(comparison->op, left, right, true) ? state : AbstractState::unreachable();
+            AbstractState whenFalse = can_be(comparison->op, left, right, false) ? state : AbstractState::unreachable();
+            narrow(whenTrue, comparison->left, comparison->op, right);
+            narrow(whenTrue, comparison->right, mirror(comparison->op), left);
+            narrow(whenFalse, comparison->left, negate(comparison->op), right);
+            narrow(whenFalse, comparison->right, mirror(negate(comparison->op)), left);
+            return {whenTrue, whenFalse};
+        }
+
+        evaluate(condition);
+        return {state, state};
+    }
+
+    /*
+    Starts analyzing a loop whose counter, if it has one, takes the values 'counter'. Joins the current state into the head its fixed point
+    iteration starts from, and if the last analysis still holds, sets 'state' to the exit it found. Every call is paired with leave_loop.
+    */
+    LoopResult& enter_loop(AST* loop, Interval counter) {
+        loopDepth++;
+        auto [it, first] = loopResults.try_emplace(loop);
+        LoopResult& result = it->second;
+        if (first) {
+            result.head = state;
+            result.counter = counter;
+            return result;
+        }
+        AbstractState head = AbstractState::join(result.head, state);
+        if (result.done && head == result.head && counter == result.counter) {
+            if (!result.exitReachable) {
+                state = AbstractState::unreachable();
+                return result;
+            }
+            state = result.head;
+            for (const auto& [name, var] : result.exitChanges) {
+                state.vars[name] = var;
+            }
+            return result;
+        }
+        result.head = std::move(head);
+        result.counter = counter;
+        result.done = false;
+        return result;
+    }
+
+    //Records that the loop's analysis reached the fixed point of its head and exits in 'exit'.
+    static void record_exit(LoopResult& result, const AbstractState& exit) {
+        result.done = true;
+        result.exitReachable = exit.reachable;
+        result.exitChanges.clear();
+        for (const auto& [name, var] : exit.vars) {
+            auto it = result.head.vars.find(name);
+            if (it == result.head.vars.end() || !(it->second == var)) result.exitChanges.emplace_back(name, var);
+        }
+    }
+
+    void leave_loop() {
+        if (--loopDepth == 0) loopResults.clear();
+    }
+
+    //Enters one iteration of a for loop: the loop variable and its derived induction variables are defined and bounded.
+    void enter_iteration(ForNode* node, Interval counter) {
+        state.vars[node->var_name] = {counter, true};
+        for (const auto& d : node->derived) {
+            state.vars[d.name] = {multiply(counter, {d.factor, d.factor}), true};
+        }
+    }
+
+public:
+    RangeAnalysis(OptimizationStats& stats_, AbstractState state_) : stats(stats_), state(std::move(state_)) {}
+
+    //Analyzes one top-level statement, removes the checks it proved unnecessary, and returns the state after it.
+    AbstractState analyze(std::unique_ptr<AST>& ast) {
+        // Nothing after a loop that can never exit will run, so there is nothing to learn about it.
+        if (state.reachable) {
+            ast->accept(*this);
+        }
+        CheckRemover remover(stats, visited, needsCheck);
+        ast->accept(remover);
+        return state;
+    }
+
+    void visit(BinaryOpNode* node) override {
+        visited.insert(node);
+        Interval left = evaluate(node->left);
+        Interval right = evaluate(node->right);
+        switch (node->op) {
+            case PLUS:
+                lastRange = Interval::of(left.lo + right.lo, left.hi + right.hi);
+                break;
+            case MINUS:
+                lastRange = Interval::of(left.lo - right.hi, left.hi - right.lo);
+                break;
+            case MUL:
+                lastRange = multiply(left, right);
+                break;
+            case DIV:
+                if (right.contains(0) || (right.contains(-1) && left.contains(INT32_MIN))) {
+                    needsCheck.insert(node);
+                }
+                lastRange = divide(left, right);
+                break;
+            default:
+                lastRange = Interval::top();
+        }
+    }
+
+    void visit(NumberNode* node) override {
+        lastRange = {node->value, node->value};
+    }
+
+    void visit(VariableNode* node) override {
+        visited.insert(node);
+        if (!state.defined(node->name)) {
+            needsCheck.insert(node);
+            // If the read did not throw, the variable is defined from here on. Its range is read before operator[] inserts an entry.
+            Interval range = state.range(node->name);
+            state.vars[node->name] = {range, true};
+        }
+        lastRange = state.range(node->name);
+    }
+
+    void visit(AssignNode* node) override {
+        Interval value = evaluate(node->value);
+        state.vars[node->name] = {value, true};
+    }
+
+    void visit(PrintNode* node) override {
+        for (const auto& expr : node->expressions) {
+            evaluate(expr);
+        }
+    }
+
+    void visit(IfNode* node) override {
+        auto [whenTrue, whenFalse] = branch(node->condition);
+        state = whenTrue;
+        execute(node->body);
+        state = AbstractState::join(state, whenFalse);
+    }
+
+    void visit(WhileNode* node) override {
+        LoopResult& loop = enter_loop(node, Interval::top());
+        if (loop.done) {
+            leave_loop();
+            return;
+        }
+        AbstractState& head = loop.head;
+        AbstractState exit;
+        for (int round = 0;; round++) {
+            state = head;
+            auto [whenTrue, whenFalse] = branch(node->condition);
+            exit = whenFalse;
+            state = whenTrue;
+            execute(node->body);
+            AbstractState next = AbstractState::join(head, state);
+            if (round >= wideningDelay) next = AbstractState::widen(head, next);
+            if (next == head) break;
+            head = next;
+        }
+        state = exit;
+        record_exit(loop, state);
+        leave_loop();
+    }
+
+    //Finds the state at the end of the loop body, given the values the counter can take in it.
+    void iterate(ForNode* node, Interval counter) {
+        LoopResult& loop = enter_loop(node, counter);
+        if (loop.done) {
+            leave_loop();
+            return;
+        }
+        AbstractState& head = loop.head;
+        for (int round = 0;; round++) {
+            state = head;
+            enter_iteration(node, counter);
+            execute(node->body);
+            AbstractState next = AbstractState::join(head, state);
+            if (round >= wideningDelay) next = AbstractState::widen(head, next);
+            if (next == head) break;
+            head = next;
+        }
+        record_exit(loop, state);
+        leave_loop();
+    }
+
+    /*
+    A while loop rewritten by CountedLoops. The counter runs from its start to the last value that can pass the test, unless stepping
+    past that value could wrap around and pass the test again. Nothing is assumed about the value the counter exits with.
+    */
+    void counted_while(ForNode* node, Interval start, Interval end) {
+        int64_t last;
+        switch (node->test) {
+            case LESS_THAN_OR_EQUAL_TO: last = end.hi; break;
+            case LESS_THAN: last = end.hi - 1; break;
+            case GREATER_THAN_OR_EQUAL_TO: last = end.lo; break;
+            default: last = end.lo + 1; break;
+        }
+        bool ascending = node->step > 0;
+        if (ascending ? start.lo > last : start.hi < last) return;
+
+        Interval counter = Interval::top();
+        if (ascending && last + node->step <= INT32_MAX) counter = {start.lo, last};
+        if (!ascending && last + node->step >= INT32_MIN) counter = {last, start.hi};
+
+        AbstractState entry = state;
+        iterate(node, counter);
+        state = AbstractState::join(entry, state);
+        state.vars[node->var_name] = {Interval::top(), true};
+    }
+
+    void visit(ForNode* node) override {
+        Interval start = evaluate(node->start);
+        Interval end = evaluate(node->end);
+        if (node->countedWhile) {
+            counted_while(node, start, end);
+            return;
+        }
+        if (start.lo > end.hi) return;
+
+        AbstractState entry = state;
+        iterate(node, {start.lo, end.hi});
+
+        // Unless the start can never exceed the end, the body may not run at all.
+        if (start.hi > end.lo) {
+            state = AbstractState::join(entry, state);
+        }
+    }
+
+    void visit(ComparisonNode* node) override {
+        visited.insert(node);
+        evaluate(node->left);
+        evaluate(node->right);
+        lastRange = {0, 1};
+    }
+
+    void visit(LogicalOpNode* node) override {
+        visited.insert(node);
+        alone(node, state);
+        evaluate(node->left);
+        evaluate(node->right);
+        lastRange = {0, 1};
+    }
+
+    void visit(DivideByConstantNode* node) override {
+        Interval left = evaluate(node->left);
+        lastRange = divide(left, {node->divisor, node->divisor});
+    }
+
+    void visit(ShiftLeftNode* node) override {
+        Interval left = evaluate(node->left);
+        int64_t factor = int64_t{1} << node->shift;
+        lastRange = multiply(left, {factor, factor});
+    }
+};
+
+/*
+SSA intermediate representation. Each top-level statement is lowered into an IRFunction: a list of basic blocks, where every block
+holds phi nodes first, then ordinary instructions, and ends with exactly one terminator (jump, branch or ret).
+Instructions are also the values they produce, and every value is assigned exactly once.
+*/
+enum class IROp {
+    Const,            // imm
+    Undef,            // a value that is never observed, e.g. a variable before its first assignment
+    Load,             // read variable 'name' from the SymbolTable, failing if it is undefined when 'checked'
+    Store,            // write operands[0] to variable 'name'
+    Binary,           // kind is PLUS, MINUS, MUL or DIV; DIV fails on a zero divisor when 'checked'
+    DivideByConstant, // operands[0] / imm using 'magic'
+    ShiftLeft,        // operands[0] << imm
+    Compare,          // kind is a comparison token, produces 0 or 1
+    Phi,              // operands[k] is the value coming from block->preds[k]
+    Copy,             // operands[0], named after the variable it was assigned to
+    Print,            // prints operands[0]; with no operands, prints a space if imm is 1 and ends the line otherwise
+    Jump,             // targets[0]
+    Branch,           // targets[0] if operands[0] is nonzero, otherwise targets[1]
+    Return
+};
+
+struct IRBlock;
+
+struct IRInstr {
+    IROp op;
+    int id = -1;
+    TokenType kind = PLUS;
+    int imm = 0;
+    DivisionMagic magic{0, 0};
+    std::string name;
+    //Load and Store: the slot of 'name', which Optimizer::lower fills in once the IR passes are done.
+    size_t slot = 0;
+    bool checked = true;
+    std::vector<IRInstr*> operands;
+    std::vector<IRBlock*> targets;
+    IRBlock* block = nullptr;
+
+    explicit IRInstr(IROp op_) : op(op_) {}
+
+    bool is_terminator() const {
+        return op == IROp::Jump || op == IROp::Branch || op == IROp::Return;
+    }
+
+    bool has_value() const {
+        return !is_terminator() && op != IROp::Store && op != IROp::Print;
+    }
+
+    //Whether removing this instruction could change what the program prints, stores or reports as an error.
+    bool has_side_effects() const {
+        switch (op) {
+            case IROp::Store:
+            case IROp::Print:
+            case IROp::Jump:
+            case IROp::Branch:
+            case IROp::Return:
+                return true;
+            case IROp::Load:
+                return checked;
+            case IROp::Binary:
+                return kind == DIV && checked;
+            default:
+                return false;
+        }
+    }
+};
+
+struct IRBlock {
+    int id;
+    std::vector<std::unique_ptr<IRInstr>> instrs;
+    std::vector<IRBlock*> preds;
+
+    explicit IRBlock(int id_) : id(id_) {}
+
+    IRInstr* terminator() const {
+        if (instrs.empty() || !instrs.back()->is_terminator()) return nullptr;
+        return instrs.back().get();
+    }
+
+    std::vector<IRBlock*> succs() const {
+        IRInstr* term = terminator();
+        return term ? term->targets : std::vector<IRBlock*>{};
+    }
+
+    size_t pred_index(const IRBlock* pred) const {
+        for (size_t k = 0; k < preds.size(); k++) {
+            if (preds[k] == pred) return k;
+        }
+        throw std::runtime_error("IR: block bb" + std::to_string(pred->id) + " is not a predecessor of bb" + std::to_string(id));
+    }
+
+    //Removes the edge from 'pred', along with the matching operand of every phi.
+    void remove_pred(const IRBlock* pred) {
+        size_t k = pred_index(pred);
+        preds.erase(preds.begin() + k);
+        for (auto& instr : instrs) {
+            if (instr->op != IROp::Phi) break;
+            instr->operands.erase(instr->operands.begin() + k);
+        }
+    }
+};
+
+struct IRFunction {
+    std::vector<std::unique_ptr<IRBlock>> blocks;
+    int nextId = 0;
+
+    IRBlock* entry() const {
+        return blocks.front().get();
+    }
+
+    IRBlock* new_block() {
+        blocks.push_back(std::make_unique<IRBlock>(static_cast<int>(blocks.size())));
+        return blocks.back().get();
+    }
+
+    std::unique_ptr<IRInstr> make(IROp op) {
+        auto instr = std::make_unique<IRInstr>(op);
+        instr->id = nextId++;
+        return instr;
+    }
+
+    //Finds or creates a constant in the entry block, which dominates every use.
+    IRInstr* constant(int value) {
+        IRBlock* block = entry();
+        for (auto& instr : block->instrs) {
+            if (instr->op == IROp::Const && instr->imm == value) return instr.get();
+        }
+        auto instr = make(IROp::Const);
+        instr->imm = value;
+        instr->block = block;
+        block->instrs.insert(block->instrs.begin(), std::move(instr));
+        return block->instrs.front().get();
+    }
+
+    void replace_all_uses(IRInstr* from, IRInstr* to) {
+        for (auto& block : blocks) {
+            for (auto& instr : block->instrs) {
+                for (auto& operand : instr->operands) {
+                    if (operand == from) operand = to;
+                }
+            }
+        }
+    }
+
+    std::unordered_map<IRInstr*, std::vector<IRInstr*>> users() const {
+        std::unordered_map<IRInstr*, std::vector<IRInstr*>> result;
+        for (auto& block : blocks) {
+            for (auto& instr : block->instrs) {
+                for (IRInstr* operand : instr->operands) {
+                    result[operand].push_back(instr.get());
+                }
+            }
+        }
+        return result;
+    }
+
+    //Gives blocks and values consecutive numbers again after passes have removed some of them.
+    void renumber() {
+        int value = 0;
+        for (size_t b = 0; b < blocks.size(); b++) {
+            blocks[b]->id = static_cast<int>(b);
+            for (auto& instr : blocks[b]->instrs) {
+                instr->id = value++;
+            }
+        }
+        nextId = value;
+    }
+};
+
+inline const char* ir_operator_name(TokenType kind) {
+    switch (kind) {
+        case PLUS: return "add";
+        case MINUS: return "sub";
+        case MUL: return "mul";
+        case DIV: return "div";
+        case EQUAL_TO: return "eq";
+        case NOT_EQUAL_TO: return "ne";
+        case GREATER_THAN: return "gt";
+        case LESS_THAN: return "lt";
+        case GREATER_THAN_OR_EQUAL_TO: return "ge";
+        case LESS_THAN_OR_EQUAL_TO: return "le";
+        default: return "?";
+    }
+}
+
+//Writes the textual form used by --dump-ir, e.g. "%4 = phi [%1, bb0], [%9, bb3]".
+inline void print_ir(const IRFunction& fn, std::ostream& out) {
+    auto value = [](const IRInstr* instr) {
+        return "%" + std::to_string(instr->id);
+    };
+    for (const auto& block : fn.blocks) {
+        out << "bb" << block->id << ":";
+        if (!block->preds.empty()) {
+            out << "  ; preds:";
+            for (const IRBlock* pred : block->preds) out << " bb" << pred->id;
+        }
+        out << "\n";
+        for (const auto& instr : block->instrs) {
+            out << "  ";
+            if (instr->has_value()) out << value(instr.get()) << " = ";
+            switch (instr->op) {
+                case IROp::Const: out << "const " << instr->imm; break;
+                case IROp::Undef: out << "undef"; break;
+                case IROp::Load: out << (instr->checked ? "load @" : "load.nocheck @") << instr->name; break;
+                case IROp::Store: out << "store @" << instr->name << ", " << value(instr->operands[0]); break;
+                case IROp::Binary:
+                    out << ir_operator_name(instr->kind) << (instr->kind == DIV && !instr->checked ? ".nocheck " : " ")
+                        << value(instr->operands[0]) << ", " << value(instr->operands[1]);
+                    break;
+                case IROp::DivideByConstant: out << "divconst " << value(instr->operands[0]) << ", " << instr->imm; break;
+                case IROp::ShiftLeft: out << "shl " << value(instr->operands[0]) << ", " << instr->imm; break;
+                case IROp::Compare:
+                    out << "cmp " << ir_operator_name(instr->kind) << " " << value(instr->operands[0]) << ", " << value(instr->operands[1]);
+                    break;
+                case IROp::Phi:
+                    out << "phi";
+                    for (size_t k = 0; k < instr->operands.size(); k++) {
+                        out << (k ? ", [" : " [") << value(instr->operands[k]) << ", bb" << block->preds[k]->id << "]";
+                    }
+                    break;
+                case IROp::Copy: out << "copy " << value(instr->operands[0]) << "  ; " << instr->name; break;
+                case IROp::Print:
+                    if (!instr->operands.empty()) {
+                        out << "print " << value(instr->operands[0]);
+                    } else {
+                        out << (instr->imm ? "print.space" : "print.newline");
+                    }
+                    break;
+                case IROp::Jump: out << "jmp bb" << instr->targets[0]->id; break;
+                case IROp::Branch:
+                    out << "br " << value(instr->operands[0]) << ", bb" << instr->targets[0]->id << ", bb" << instr->targets[1]->id;
+                    break;
+                case IROp::Return: out << "ret"; break;
+            }
+            out << "\n";
+        }
+    }
+}
+
+/*
+Lowers one top-level statement into SSA form, using the on-the-fly construction of Braun et al. ("Simple and Efficient Construction of
+Static Single Assignment Form"): reading a variable looks for its definition in the current block, then recursively in predecessors,
+placing phi nodes at joins and removing them again when they turn out to be trivial.
+
+Variables live in the SymbolTable between statements. A variable is promoted to SSA values when every read is guaranteed to see a
+definition: it is defined before the statement, or it is assigned before every read. Promoted variables are loaded once at entry and,
+if they are certain to be defined at the end, stored back before 'ret'; otherwise every assignment also writes through to the
+SymbolTable, so a variable only assigned on some paths is left undefined on the others. Any variable that might be read before it is
+defined keeps a load at each read and a store at each assignment, so "Undefined variable" errors still happen exactly where the
+tree-walking Interpreter would report them.
+*/
+class IRLowering : public ASTVisitor {
+private:
+    IRFunction fn;
+    IRBlock* current = nullptr;
+    IRInstr* result = nullptr;
+    IRInstr* undefValue = nullptr;
+    const AbstractState& entryState;
+    std::unordered_set<std::string> memoryVars;
+    std::unordered_set<std::string> writeThroughVars;
+    std::unordered_set<std::string> assignedVars;
+    std::unordered_set<std::string> transientVars;
+
+    std::unordered_map<std::string, std::unordered_map<IRBlock*, IRInstr*>> currentDef;
+    std::unordered_set<IRBlock*> sealed;
+    std::unordered_map<IRBlock*, std::vector<std::pair<std::string, IRInstr*>>> incompletePhis;
+    std::vector<std::unique_ptr<IRInstr>> removedPhis;
+    //The value each removed phi was replaced by, which may itself be a phi that was removed later.
+    std::unordered_map<IRInstr*, IRInstr*> replacedPhis;
+
+    /*
+    Walks the statement in execution order, tracking which variables are certainly assigned, to find the variables that must stay in
+    memory: those read where they might not be assigned yet, and those that might not be assigned at the end.
+    */
+    class Promotion : public ASTPass {
+    public:
+        const AbstractState& entry;
+        std::unordered_set<std::string> assigned;
+        std::unordered_set<std::string> unsafe;
+        std::unordered_set<std::string> written;
+
+        explicit Promotion(const AbstractState& entry_) : entry(entry_) {}
+
+        void visit(VariableNode* node) override {
+            if (!assigned.count(node->name) && !entry.defined(node->name)) unsafe.insert(node->name);
+        }
+
+        void visit(AssignNode* node) override {
+            ASTPass::visit(node);
+            assigned.insert(node->name);
+            written.insert(node->name);
+        }
+
+        void visit(IfNode* node) override {
+            run(node->condition);
+            auto before = assigned;
+            run(node->body);
+            assigned = before;
+        }
+
+        void visit(WhileNode* node) override {
+            run(node->condition);
+            auto before = assigned;
+            run(node->body);
+            assigned = before;
+        }
+
+        void visit(ForNode* node) override {
+            run(node->start);
+            run(node->end);
+            auto before = assigned;
+            assigned.insert(node->var_name);
+            written.insert(node->var_name);
+            for (const auto& d : node->derived) assigned.insert(d.name);
+            run(node->body);
+            assigned = before;
+        }
+    };
+
+    IRInstr* emit(std::unique_ptr<IRInstr> instr) {
+        instr->block = current;
+        current->instrs.push_back(std::move(instr));
+        return current->instrs.back().get();
+    }
+
+    IRInstr* emit(IROp op, std::vector<IRInstr*> operands) {
+        auto instr = fn.make(op);
+        instr->operands = std::move(operands);
+        return emit(std::move(instr));
+    }
+
+    void jump(IRBlock* target) {
+        auto instr = fn.make(IROp::Jump);
+        instr->targets = {target};
+        emit(std::move(instr));
+        target->preds.push_back(current);
+    }
+
+    void branch(IRInstr* condition, IRBlock* whenTrue, IRBlock* whenFalse) {
+        auto instr = fn.make(IROp::Branch);
+        instr->operands = {condition};
+        instr->targets = {whenTrue, whenFalse};
+        emit(std::move(instr));
+        whenTrue->preds.push_back(current);
+        whenFalse->preds.push_back(current);
+    }
+
+    IRInstr* new_phi(IRBlock* block) {
+        auto phi = fn.make(IROp::Phi);
+        phi->block = block;
+        auto& instrs = block->instrs;
+        auto position = instrs.begin();
+        while (position != instrs.end() && (*position)->op == IROp::Phi) ++position;
+        return instrs.insert(position, std::move(phi))->get();
+    }
+
+    IRInstr* undef() {
+        if (!undefValue) {
+            auto instr = fn.make(IROp::Undef);
+            instr->block = fn.entry();
+            fn.entry()->instrs.insert(fn.entry()->instrs.begin(), std::move(instr));
+            undefValue = fn.entry()->instrs.front().get();
+        }
+        return undefValue;
+    }
+
+    //The value a promoted variable has when the statement starts.
+    IRInstr* entry_value(const std::string& name) {
+        //A frame slot is always written before it is read, so its value from before the statement is never used.
+        if (!entryState.defined(name) || is_frame_slot(name)) return undef();
+        auto load = fn.make(IROp::Load);
+        load->name = name;
+        load->checked = false;
+        load->block = fn.entry();
+        fn.entry()->instrs.insert(fn.entry()->instrs.begin(), std::move(load));
+        return fn.entry()->instrs.front().get();
+    }
+
+    void write_variable(const std::string& name, IRBlock* block, IRInstr* value) {
+        currentDef[name][block] = value;
+    }
+
+    IRInstr* read_variable(const std::string& name, IRBlock* block) {
+        auto& defs = currentDef[name];
+        auto it = defs.find(block);
+        if (it != defs.end()) return it->second;
+        return read_variable_recursive(name, block);
+    }
+
+    IRInstr* read_variable_recursive(const std::string& name, IRBlock* block) {
+        IRInstr* value;
+        if (!sealed.count(block)) {
+            value = new_phi(block);
+            incompletePhis[block].push_back({name, value});
+        } else if (block->preds.empty()) {
+            value = entry_value(name);
+        } else if (block->preds.size() == 1) {
+            value = read_variable(name, block->preds[0]);
+        } else {
+            value = new_phi(block);
+            write_variable(name, block, value);
+            value = add_phi_operands(name, value);
+        }
+        write_variable(name, block, value);
+        return value;
+    }
+
+    IRInstr* add_phi_operands(const std::string& name, IRInstr* phi) {
+        for (IRBlock* pred : phi->block->preds) {
+            phi->operands.push_back(read_variable(name, pred));
+        }
+        return try_remove_trivial_phi(phi);
+    }
+
+    //A phi whose operands are all the same value (or the phi itself) is replaced by that value.
+    IRInstr* try_remove_trivial_phi(IRInstr* phi) {
+        IRInstr* same = nullptr;
+        for (IRInstr* operand : phi->operands) {
+            if (operand == same || operand == phi) continue;
+            if (same) return phi;
+            same = operand;
+        }
+        if (!same) same = undef();
+
+        std::vector<IRInstr*> phiUsers;
+        for (auto& block : fn.blocks) {
+            for (auto& instr : block->instrs) {
+                if (instr.get() == phi || instr->op != IROp::Phi) continue;
+                for (IRInstr* operand : instr->operands) {
+                    if (operand == phi) {
+                        phiUsers.push_back(instr.get());
+                        break;
+                    }
+                }
+            }
+        }
+
+        fn.replace_all_uses(phi, same);
+        replacedPhis[phi] = same;
+        for (auto& [name, defs] : currentDef) {
+            for (auto& [block, value] : defs) {
+                if (value == phi) value = same;
+            }
+        }
+        for (auto& [block, pending] : incompletePhis) {
+            for (auto& [name, value] : pending) {
+                if (value == phi) value = same;
+            }
+        }
+
+        // Keep the removed phi alive until lowering finishes, since callers up the stack may still hold it.
+        auto& instrs = phi->block->instrs;
+        for (auto it = instrs.begin(); it != instrs.end(); ++it) {
+            if (it->get() == phi) {
+                removedPhis.push_back(std::move(*it));
+                instrs.erase(it);
+                break;
+            }
+        }
+
+        for (IRInstr* user : phiUsers) {
+            bool stillPresent = false;
+            for (auto& instr : user->block->instrs) {
+                if (instr.get() == user) stillPresent = true;
+            }
+            if (stillPresent) try_remove_trivial_phi(user);
+        }
+        // Removing the users can remove 'same' too, when it is a phi that used one of them.
+        while (replacedPhis.count(same)) same = replacedPhis[same];
+        return same;
+    }
+
+    void seal(IRBlock* block) {
+        auto pending = std::move(incompletePhis[block]);
+        incompletePhis.erase(block);
+        sealed.insert(block);
+        for (auto& [name, phi] : pending) {
+            if (phi->op == IROp::Phi && phi->operands.empty()) add_phi_operands(name, phi);
+        }
+    }
+
+    IRInstr* lower(const std::unique_ptr<AST>& node) {
+        node->accept(*this);
+        return result;
+    }
+
+    void lower(const std::vector<std::unique_ptr<AST>>& body) {
+        for (const auto& stmt : body) {
+            stmt->accept(*this);
+        }
+    }
+
+    void assign(const std::string& name, IRInstr* value) {
+        if (memoryVars.count(name) || writeThroughVars.count(name)) {
+            auto store = fn.make(IROp::Store);
+            store->name = name;
+            store->operands = {value};
+            emit(std::move(store));
+            if (memoryVars.count(name)) return;
+        }
+        auto copy = fn.make(IROp::Copy);
+        copy->name = name;
+        copy->operands = {value};
+        write_variable(name, current, emit(std::move(copy)));
+    }
+
+    //Lowers a condition straight into branches, so 'and'/'or' short-circuit through control flow instead of materializing booleans.
+    void lower_condition(const std::unique_ptr<AST>& condition, IRBlock* whenTrue, IRBlock* whenFalse) {
+        if (auto logical = dynamic_cast<LogicalOpNode*>(condition.get())) {
+            IRBlock* next = fn.new_block();
+            if (logical->op == AND) {
+                lower_condition(logical->left, next, whenFalse);
+            } else {
+                lower_condition(logical->left, whenTrue, next);
+            }
+            seal(next);
+            current = next;
+            lower_condition(logical->right, whenTrue, whenFalse);
+            return;
+        }
+        IRInstr* value = lower(condition);
+        branch(value, whenTrue, whenFalse);
+    }
+
+public:
+    explicit IRLowering(const AbstractState& entryState_) : entryState(entryState_) {}
+
+    IRFunction lower_statement(const std::unique_ptr<AST>& ast) {
+        Promotion promotion(entryState);
+        ast->accept(promotion);
+        memoryVars = promotion.unsafe;
+        for (const std::string& name : promotion.written) {
+            //Frame slots are dead once the statement ends, so they stay in registers and are never stored.
+            if (is_frame_slot(name)) {
+                transientVars.insert(name);
+                continue;
+            }
+            if (!memoryVars.count(name) && !promotion.assigned.count(name) && !entryState.defined(name)) writeThroughVars.insert(name);
+        }
+
+        current = fn.new_block();
+        seal(current);
+        ast->accept(*this);
+
+        // Write promoted variables back so the next statement sees them.
+        std::vector<std::string> names(assignedVars.begin(), assignedVars.end());
+        std::sort(names.begin(), names.end());
+        for (const std::string& name : names) {
+            if (memoryVars.count(name) || writeThroughVars.count(name) || transientVars.count(name)) continue;
+            auto store = fn.make(IROp::Store);
+            store->name = name;
+            store->operands = {read_variable(name, current)};
+            emit(std::move(store));
+        }
+        emit(fn.make(IROp::Return));
+        fn.renumber();
+        return std::move(fn);
+    }
+
+    void visit(BinaryOpNode* node) override {
+        IRInstr* left = lower(node->left);
+        IRInstr* right = lower(node->right);
+        auto instr = fn.make(IROp::Binary);
+        instr->kind = node->op;
+        instr->checked = node->checkDivisor;
+        instr->operands = {left, right};
+        result = emit(std::move(instr));
+    }
+
+    void visit(NumberNode* node) override {
+        result = fn.constant(node->value);
+    }
+
+    void visit(VariableNode* node) override {
+        if (memoryVars.count(node->name)) {
+            auto load = fn.make(IROp::Load);
+            load->name = node->name;
+            load->checked = node->checkDefined;
+            result = emit(std::move(load));
+            return;
+        }
+        result = read_variable(node->name, current);
+    }
+
+    void visit(AssignNode* node) override {
+        assign(node->name, lower(node->value));
+        assignedVars.insert(node->name);
+    }
+
+    //Each value is printed as soon as it is computed, so output written before a failing expression still appears.
+    void visit(PrintNode* node) override {
+        for (size_t k = 0; k < node->expressions.size(); k++) {
+            if (k > 0) {
+                auto space = fn.make(IROp::Print);
+                space->imm = 1;
+                emit(std::move(space));
+            }
+            emit(IROp::Print, {lower(node->expressions[k])});
+        }
+        emit(IROp::Print, {});
+    }
+
+    void visit(IfNode* node) override {
+        IRBlock* body = fn.new_block();
+        IRBlock* after = fn.new_block();
+        lower_condition(node->condition, body, after);
+        seal(body);
+        current = body;
+        lower(node->body);
+        jump(after);
+        seal(after);
+        current = after;
+    }
+
+    void visit(WhileNode* node) override {
+        IRBlock* header = fn.new_block();
+        IRBlock* body = fn.new_block();
+        IRBlock* exit = fn.new_block();
+        jump(header);
+        current = header;
+        lower_condition(node->condition, body, exit);
+        seal(body);
+        current = body;
+        lower(node->body);
+        jump(header);
+        seal(header);
+        seal(exit);
+        current = exit;
+    }
+
+    void visit(ForNode* node) override {
+        IRInstr* start = lower(node->start);
+        IRInstr* end = lower(node->end);
+        std::vector<IRInstr*> derivedStart;
+        for (const auto& d : node->derived) {
+            auto mul = fn.make(IROp::Binary);
+            mul->kind = MUL;
+            mul->operands = {start, fn.constant(d.factor)};
+            derivedStart.push_back(emit(std::move(mul)));
+        }
+
+        IRBlock* header = fn.new_block();
+        IRBlock* body = fn.new_block();
+        IRBlock* exit = fn.new_block();
+        jump(header);
+        current = header;
+
+        // The counter and derived values are phis we fill in by hand, not variables, because the body may not change them.
+        IRInstr* counter = new_phi(header);
+        counter->operands.push_back(start);
+        std::vector<IRInstr*> derived;
+        for (IRInstr* value : derivedStart) {
+            derived.push_back(new_phi(header));
+            derived.back()->operands.push_back(value);
+        }
+        auto compare = fn.make(IROp::Compare);
+        compare->kind = node->test;
+        compare->operands = {counter, end};
+        branch(emit(std::move(compare)), body, exit);
+
+        seal(body);
+        current = body;
+        assign(node->var_name, counter);
+        assignedVars.insert(node->var_name);
+        for (size_t k = 0; k < derived.size(); k++) {
+            write_variable(node->derived[k].name, current, derived[k]);
+            transientVars.insert(node->derived[k].name);
+        }
+        lower(node->body);
+
+        auto next = fn.make(IROp::Binary);
+        next->kind = PLUS;
+        next->operands = {counter, fn.constant(node->step)};
+        counter->operands.push_back(emit(std::move(next)));
+        for (size_t k = 0; k < derived.size(); k++) {
+            auto step = fn.make(IROp::Binary);
+            step->kind = PLUS;
+            step->operands = {derived[k], fn.constant(wrapping_mul(node->derived[k].factor, node->step))};
+            derived[k]->operands.push_back(emit(std::move(step)));
+        }
+        jump(header);
+        seal(header);
+        seal(exit);
+        current = exit;
+        // A rewritten while loop leaves its variable at the value that failed the test, which is the header's counter.
+        if (node->countedWhile) {
+            assign(node->var_name, counter);
+        }
+    }
+
+    void visit(ComparisonNode* node) override {
+        IRInstr* left = lower(node->left);
+        IRInstr* right = lower(node->right);
+        auto instr = fn.make(IROp::Compare);
+        instr->kind = node->op;
+        instr->operands = {left, right};
+        result = emit(std::move(instr));
+    }
+
+    void visit(LogicalOpNode*) override {
+        throw std::runtime_error("IR: logical operator outside of a condition");
+    }
+
+    void visit(DivideByConstantNode* node) override {
+        auto instr = fn.make(IROp::DivideByConstant);
+        instr->operands = {lower(node->left)};
+        instr->imm = node->divisor;
+        instr->magic = node->magic;
+        result = emit(std::move(instr));
+    }
+
+    void visit(ShiftLeftNode* node) override {
+        auto instr = fn.make(IROp::ShiftLeft);
+        instr->operands = {lower(node->left)};
+        instr->imm = node->shift;
+        result = emit(std::move(instr));
+    }
+};
+
+/*
+Checks the structural rules every pass must preserve: blocks end in exactly one terminator, phis come first and have one operand per
+predecessor, predecessor and successor lists agree, every block is reachable, and every value is defined before it is used (its block
+dominates the use, or for a phi operand, the end of the matching predecessor). Throws a runtime_error naming the broken rule.
+*/
+class IRVerifier {
+private:
+    std::unordered_map<IRBlock*, IRBlock*> idom;
+    std::unordered_map<IRBlock*, size_t> order;
+
+    [[noreturn]] static void fail(const std::string& stage, const std::string& message) {
+        throw std::runtime_error("IR verification failed after " + stage + ": " + message);
+    }
+
+    bool dominates(IRBlock* a, IRBlock* b) const {
+        while (true) {
+            if (a == b) return true;
+            IRBlock* parent = idom.at(b);
+            if (parent == b) return false;
+            b = parent;
+        }
+    }
+
+    //Immediate dominators by the iterative algorithm of Cooper, Harvey and Kennedy, over blocks in reverse postorder.
+    void compute_dominators(const IRFunction& fn, const std::string& stage) {
+        std::vector<IRBlock*> postorder;
+        std::unordered_set<IRBlock*> seen;
+        std::vector<std::pair<IRBlock*, size_t>> stack{{fn.entry(), 0}};
+        seen.insert(fn.entry());
+        while (!stack.empty()) {
+            auto& [block, next] = stack.back();
+            std::vector<IRBlock*> succs = block->succs();
+            if (next < succs.size()) {
+                IRBlock* succ = succs[next++];
+                if (seen.insert(succ).second) stack.push_back({succ, 0});
+            } else {
+                postorder.push_back(block);
+                stack.pop_back();
+            }
+        }
+        if (postorder.size() != fn.blocks.size()) fail(stage, "unreachable block");
+
+        std::vector<IRBlock*> rpo(postorder.rbegin(), postorder.rend());
+        for (size_t k = 0; k < rpo.size(); k++) order[rpo[k]] = k;
+        idom[fn.entry()] = fn.entry();
+
+        auto intersect = [&](IRBlock* a, IRBlock* b) {
+            while (a != b) {
+                while (order[a] > order[b]) a = idom[a];
+                while (order[b] > order[a]) b = idom[b];
+            }
+            return a;
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t k = 1; k < rpo.size(); k++) {
+                IRBlock* block = rpo[k];
+                IRBlock* newIdom = nullptr;
+                for (IRBlock* pred : block->preds) {
+                    if (!idom.count(pred)) continue;
+                    newIdom = newIdom ? intersect(pred, newIdom) : pred;
+                }
+                if (idom[block] != newIdom) {
+                    idom[block] = newIdom;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+public:
+    void verify(const IRFunction& fn, const std::string& stage) {
+        if (fn.blocks.empty()) fail(stage, "function has no blocks");
+        if (!fn.entry()->preds.empty()) fail(stage, "entry block has predecessors");
+
+        std::unordered_map<const IRInstr*, size_t> position;
+        for (const auto& block : fn.blocks) {
+            const std::string where = "bb" + std::to_string(block->id);
+            if (!block->terminator()) fail(stage, where + " does not end in a terminator");
+            bool phisDone = false;
+            for (size_t k = 0; k < block->instrs.size(); k++) {
+                const IRInstr* instr = block->instrs[k].get();
+                if (instr->block != block.get()) fail(stage, where + " holds an instruction of another block");
+                if (instr->is_terminator() && k + 1 != block->instrs.size()) fail(stage, where + " has a terminator before its end");
+                if (instr->op == IROp::Phi) {
+                    if (phisDone) fail(stage, where + " has a phi after other instructions");
+                    if (instr->operands.size() != block->preds.size()) fail(stage, where + " has a phi with the wrong number of operands");
+                } else {
+                    phisDone = true;
+                }
+                position[instr] = k;
+            }
+            for (IRBlock* succ : block->succs()) {
+                size_t edges = std::count(succ->preds.begin(), succ->preds.end(), block.get());
+                size_t expected = 0;
+                for (IRBlock* target : block->succs()) expected += target == succ;
+                if (edges != expected) fail(stage, where + " is missing from the predecessors of bb" + std::to_string(succ->id));
+            }
+            for (IRBlock* pred : block->preds) {
+                std::vector<IRBlock*> succs = pred->succs();
+                if (std::find(succs.begin(), succs.end(), block.get()) == succs.end()) {
+                    fail(stage, where + " lists bb" + std::to_string(pred->id) + " as a predecessor, but it does not branch here");
+                }
+            }
+        }
+
+        compute_dominators(fn, stage);
+
+        for (const auto& block : fn.blocks) {
+            for (const auto& instr : block->instrs) {
+                for (size_t k = 0; k < instr->operands.size(); k++) {
+                    const IRInstr* operand = instr->operands[k];
+                    const std::string where = "%" + std::to_string(instr->id) + " in bb" + std::to_string(block->id);
+                    if (!position.count(operand)) fail(stage, where + " uses a value that is not in the function");
+                    if (!operand->has_value()) fail(stage, where + " uses an instruction without a value");
+                    IRBlock* def = operand->block;
+                    if (instr->op == IROp::Phi) {
+                        if (!dominates(def, block->preds[k])) fail(stage, where + " has a phi operand that does not dominate its edge");
+                    } else if (def == block.get()) {
+                        if (position[operand] >= position[instr.get()]) fail(stage, where + " uses a value before it is defined");
+                    } else if (!dominates(def, block.get())) {
+                        fail(stage, where + " uses a value whose definition does not dominate it");
+                    }
+                }
+            }
+        }
+    }
+};
+
+//A transformation over an IRFunction. Returns whether it changed anything.
+class IRPass {
+public:
+    virtual ~IRPass() = default;
+    virtual const char* name() const = 0;
+    virtual bool run(IRFunction& fn) = 0;
+};
+
+/* Runs IR passes in order, verifying the function before the first pass and after every pass. */
+class PassManager {
+private:
+    std::vector<std::unique_ptr<IRPass>> passes;
+
+public:
+    void add(std::unique_ptr<IRPass> pass) {
+        passes.push_back(std::move(pass));
+    }
+
+    void run(IRFunction& fn) {
+        IRVerifier().verify(fn, "lowering");
+        for (auto& pass : passes) {
+            pass->run(fn);
+            fn.renumber();
+            IRVerifier().verify(fn, pass->name());
+        }
+    }
+};
+
+/*
+Replaces every use of a copy with the copied value, and every phi whose incoming values are all the same (ignoring itself) with that
+value. Repeats until nothing changes, since removing one phi can make another trivial.
+*/
+class CopyPropagation : public IRPass {
+private:
+    OptimizationStats& stats;
+
+public:
+    explicit CopyPropagation(OptimizationStats& stats_) : stats(stats_) {}
+
+    const char* name() const override {
+        return "copy propagation";
+    }
+
+    bool run(IRFunction& fn) override {
+        bool changedAny = false;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto& block : fn.blocks) {
+                for (size_t k = 0; k < block->instrs.size(); k++) {
+                    IRInstr* instr = block->instrs[k].get();
+                    IRInstr* source = nullptr;
+                    if (instr->op == IROp::Copy) {
+                        source = instr->operands[0];
+                    } else if (instr->op == IROp::Phi) {
+                        for (IRInstr* operand : instr->operands) {
+                            if (operand == instr || operand == source) continue;
+                            if (source) {
+                                source = nullptr;
+                                break;
+                            }
+                            source = operand;
+                        }
+                    }
+                    if (!source) continue;
+                    fn.replace_all_uses(instr, source);
+                    block->instrs.erase(block->instrs.begin() + k);
+                    k--;
+                    stats.copiesPropagated++;
+                    changed = changedAny = true;
+                }
+            }
+        }
+        return changedAny;
+    }
+};
+
+/*
+Sparse conditional constant propagation (Wegman and Zadeck). Every value starts unknown and only moves down the lattice
+unknown -> constant -> varying, while blocks only become executable when a branch that can actually be taken reaches them.
+Because a branch on a constant marks just one edge executable, constants flowing around loops and through ifs are found even when a
+plain constant folder would give up at the phi. Afterwards constant values are replaced by constants, constant branches by jumps,
+and never-executed blocks are removed. Division by a zero constant is never folded, so it still fails at runtime.
+*/
+class SparseConditionalConstantPropagation : public IRPass {
+private:
+    enum class Lattice { Unknown, Constant, Varying };
+
+    struct Cell {
+        Lattice state = Lattice::Unknown;
+        int value = 0;
+    };
+
+    OptimizationStats& stats;
+    std::unordered_map<IRInstr*, Cell> cells;
+    std::unordered_set<IRBlock*> executableBlocks;
+    std::set<std::pair<IRBlock*, IRBlock*>> executableEdges;
+    std::vector<std::pair<IRBlock*, IRBlock*>> cfgWork;
+    std::vector<IRInstr*> ssaWork;
+    std::unordered_map<IRInstr*, std::vector<IRInstr*>> users;
+
+    static std::optional<int> fold(const IRInstr* instr, const std::vector<int>& args) {
+        switch (instr->op) {
+            case IROp::Binary:
+                switch (instr->kind) {
+                    case PLUS: return wrapping_add(args[0], args[1]);
+                    case MINUS: return wrapping_sub(args[0], args[1]);
+                    case MUL: return wrapping_mul(args[0], args[1]);
+                    case DIV:
+                        if (args[1] == 0) return std::nullopt;
+                        return checked_div(args[0], args[1]);
+                    default: return std::nullopt;
+                }
+            case IROp::DivideByConstant: return magic_divide(args[0], instr->imm, instr->magic);
+            case IROp::ShiftLeft: return static_cast<int>(static_cast<uint32_t>(args[0]) << instr->imm);
+            case IROp::Compare:
+                switch (instr->kind) {
+                    case EQUAL_TO: return args[0] == args[1];
+                    case NOT_EQUAL_TO: return args[0] != args[1];
+                    case GREATER_THAN: return args[0] > args[1];
+                    case LESS_THAN: return args[0] < args[1];
+                    case GREATER_THAN_OR_EQUAL_TO: return args[0] >= args[1];
+                    case LESS_THAN_OR_EQUAL_TO: return args[0] <= args[1];
+                    default: return std::nullopt;
+                }
+            case IROp::Copy: return args[0];
+            default: return std::nullopt;
+        }
+    }
+
+    void set(IRInstr* instr, Cell cell) {
+        Cell& old = cells[instr];
+        if (old.state == cell.state && old.value == cell.value) return;
+        old = cell;
+        for (IRInstr* user : users[instr]) ssaWork.push_back(user);
+    }
+
+    void mark_edge(IRBlock* from, IRBlock* to) {
+        cfgWork.push_back({from, to});
+    }
+
+    void evaluate(IRInstr* instr) {
+        IRBlock* block = instr->block;
+        switch (instr->op) {
+            case IROp::Const:
+                set(instr, {Lattice::Constant, instr->imm});
+                return;
+            case IROp::Undef:
+            case IROp::Load:
+                set(instr, {Lattice::Varying, 0});
+                return;
+            case IROp::Phi: {
+                Cell merged;
+                for (size_t k = 0; k < instr->operands.size(); k++) {
+                    if (!executableEdges.count({block->preds[k], block})) continue;
+                    Cell in = cells[instr->operands[k]];
+                    if (in.state == Lattice::Unknown) continue;
+                    if (in.state == Lattice::Varying || (merged.state == Lattice::Constant && merged.value != in.value)) {
+                        merged = {Lattice::Varying, 0};
+                        break;
+                    }
+                    merged = in;
+                }
+                set(instr, merged);
+                return;
+            }
+            case IROp::Jump:
+                mark_edge(block, instr->targets[0]);
+                return;
+            case IROp::Branch: {
+                Cell condition = cells[instr->operands[0]];
+                if (condition.state == Lattice::Varying) {
+                    mark_edge(block, instr->targets[0]);
+                    mark_edge(block, instr->targets[1]);
+                } else if (condition.state == Lattice::Constant) {
+                    mark_edge(block, instr->targets[condition.value ? 0 : 1]);
+                }
+                return;
+            }
+            case IROp::Store:
+            case IROp::Print:
+            case IROp::Return:
+                return;
+            default:
+                break;
+        }
+
+        std::vector<int> args;
+        for (IRInstr* operand : instr->operands) {
+            Cell in = cells[operand];
+            if (in.state == Lattice::Varying) {
+                set(instr, {Lattice::Varying, 0});
+                return;
+            }
+            if (in.state == Lattice::Unknown) return;
+            args.push_back(in.value);
+        }
+        std::optional<int> value = fold(instr, args);
+        set(instr, value ? Cell{Lattice::Constant, *value} : Cell{Lattice::Varying, 0});
+    }
+
+    void solve(IRFunction& fn) {
+        users = fn.users();
+        executableBlocks.insert(fn.entry());
+        for (auto& instr : fn.entry()->instrs) evaluate(instr.get());
+
+        while (!cfgWork.empty() || !ssaWork.empty()) {
+            while (!cfgWork.empty()) {
+                auto edge = cfgWork.back();
+                cfgWork.pop_back();
+                if (!executableEdges.insert(edge).second) continue;
+                IRBlock* block = edge.second;
+                bool firstVisit = executableBlocks.insert(block).second;
+                for (auto& instr : block->instrs) {
+                    if (!firstVisit && instr->op != IROp::Phi) break;
+                    evaluate(instr.get());
+                }
+            }
+            while (!ssaWork.empty()) {
+                IRInstr* instr = ssaWork.back();
+                ssaWork.pop_back();
+                if (executableBlocks.count(instr->block)) evaluate(instr);
+            }
+        }
+    }
+
+public:
+    explicit SparseConditionalConstantPropagation(OptimizationStats& stats_) : stats(stats_) {}
+
+    const char* name() const override {
+        return "sparse conditional constant propagation";
+    }
+
+    bool run(IRFunction& fn) override {
+        solve(fn);
+        bool changed = false;
+
+        // Branches that can only go one way become jumps.
+        for (auto& block : fn.blocks) {
+            IRInstr* term = block->terminator();
+            if (!executableBlocks.count(block.get()) || term->op != IROp::Branch) continue;
+            Cell condition = cells[term->operands[0]];
+            if (condition.state != Lattice::Constant) continue;
+            IRBlock* taken = term->targets[condition.value ? 0 : 1];
+            IRBlock* dropped = term->targets[condition.value ? 1 : 0];
+            dropped->remove_pred(block.get());
+            term->op = IROp::Jump;
+            term->operands.clear();
+            term->targets = {taken};
+            stats.branchesFolded++;
+            changed = true;
+        }
+
+        // Blocks no execution can reach are removed, along with their edges into reachable blocks.
+        for (auto& block : fn.blocks) {
+            if (executableBlocks.count(block.get())) continue;
+            for (IRBlock* succ : block->succs()) {
+                if (executableBlocks.count(succ)) succ->remove_pred(block.get());
+            }
+        }
+        size_t before = fn.blocks.size();
+        fn.blocks.erase(std::remove_if(fn.blocks.begin(), fn.blocks.end(), [&](const std::unique_ptr<IRBlock>& block) {
+            return !executableBlocks.count(block.get());
+        }), fn.blocks.end());
+        if (fn.blocks.size() != before) {
+            stats.blocksRemoved += static_cast<int>(before - fn.blocks.size());
+            changed = true;
+        }
+
+        // Values proven constant are replaced by constants from the entry block. A folded division had a nonzero constant divisor, so it cannot fail.
+        std::unordered_set<IRInstr*> folded;
+        for (auto& block : fn.blocks) {
+            for (auto& instr : block->instrs) {
+                Cell cell = cells[instr.get()];
+                if (cell.state != Lattice::Constant || instr->op == IROp::Const) continue;
+                if (instr->has_side_effects() && !(instr->op == IROp::Binary && instr->kind == DIV)) continue;
+                folded.insert(instr.get());
+            }
+        }
+        for (IRInstr* instr : folded) {
+            fn.replace_all_uses(instr, fn.constant(cells[instr].value));
+        }
+        for (auto& block : fn.blocks) {
+            auto& instrs = block->instrs;
+            instrs.erase(std::remove_if(instrs.begin(), instrs.end(), [&](const std::unique_ptr<IRInstr>& instr) {
+                return folded.count(instr.get()) > 0;
+            }), instrs.end());
+        }
+        stats.constantsFolded += static_cast<int>(folded.size());
+        return changed || !folded.empty();
+    }
+};
+
+//Removes instructions whose values are never used and that cannot print, store, or fail.
+class DeadCodeElimination : public IRPass {
+public:
+    const char* name() const override {
+        return "dead code elimination";
+    }
+
+    bool run(IRFunction& fn) override {
+        bool changedAny = false;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            auto users = fn.users();
+            for (auto& block : fn.blocks) {
+                auto& instrs = block->instrs;
+                auto dead = [&](const std::unique_ptr<IRInstr>& instr) {
+                    if (instr->has_side_effects()) return false;
+                    auto it = users.find(instr.get());
+                    if (it == users.end()) return true;
+                    // A phi only used by itself is dead too.
+                    return std::all_of(it->second.begin(), it->second.end(), [&](IRInstr* user) { return user == instr.get(); });
+                };
+                size_t before = instrs.size();
+                instrs.erase(std::remove_if(instrs.begin(), instrs.end(), dead), instrs.end());
+                if (instrs.size() != before) changed = changedAny = true;
+            }
+        }
+        return changedAny;
+    }
+};
+
+/*
+IR flattened for running. The functions, blocks, instructions, operands and predecessors of a set of statements are each one array of
+plain structs that refer to each other by index, and every name is a range of one block of characters. Nothing in it is a pointer, so a
+saved program is run straight from the pages of the file it was mapped from. An IRCode only views its arrays; whoever made it keeps
+them alive. Blocks, targets and predecessors are numbered across all the functions; operands are values of their own function.
+*/
+struct IRCode {
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Name {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Function {
+        uint32_t values;
+        uint32_t firstBlock;
+        uint32_t blockCount;
+    };
+
+    struct Block {
+        uint32_t id;
+        uint32_t firstInstr;
+        uint32_t instrCount;
+        uint32_t firstPred;
+        uint32_t predCount;
+    };
+
+    struct Instr {
+        uint8_t op;
+        uint8_t checked;
+        uint16_t reserved;
+        int32_t kind;
+        int32_t imm;
+        int32_t multiplier;
+        int32_t shift;
+        uint32_t value;
+        uint32_t slot;
+        uint32_t firstOperand;
+        uint32_t operandCount;
+        uint32_t targets[2];
+        Name name;
+    };
+
+    //How many of each array a saved image holds, and where the error is in its characters. The arrays follow in this order.
+    struct Header {
+        uint32_t names;
+        uint32_t functions;
+        uint32_t blocks;
+        uint32_t instrs;
+        uint32_t operands;
+        uint32_t preds;
+        uint32_t characters;
+        Name error;
+    };
+
+    Header counts{};
+    const Name* names = nullptr;
+    const Function* functions = nullptr;
+    const Block* blocks = nullptr;
+    const Instr* instrs = nullptr;
+    const uint32_t* operands = nullptr;
+    const uint32_t* preds = nullptr;
+    const char* characters = nullptr;
+
+    std::string_view text(Name name) const {
+        return std::string_view(characters + name.offset, name.length);
+    }
+
+    //The position of 'pred' among the predecessors of 'block', which is the operand a phi in 'block' takes when coming from 'pred'.
+    size_t pred_index(const Block& block, uint32_t pred) const {
+        for (size_t k = 0; k < block.predCount; k++) {
+            if (preds[block.firstPred + k] == pred) return k;
+        }
+        throw std::runtime_error("IR: block bb" + std::to_string(blocks[pred].id) + " is not a predecessor of bb" + std::to_string(block.id));
+    }
+
+    /*
+    Flattens IRFunctions into the arrays of an IRCode, and writes them out as an image that view() reads back in place. The arrays keep
+    their capacity when cleared, so flattening statement after statement stops allocating once the largest has been seen.
+    */
+    class Writer {
+    private:
+        std::vector<Name> names;
+        std::vector<Function> functions;
+        std::vector<Block> blocks;
+        std::vector<Instr> instrs;
+        std::vector<uint32_t> operands;
+        std::vector<uint32_t> preds;
+        std::string characters;
+        Name error{0, 0};
+
+        template <typename T>
+        static void append(std::string& out, const T* items, size_t count) {
+            out.append(reinterpret_cast<const char*>(items), count * sizeof(T));
+        }
+
+    public:
+        void clear() {
+            names.clear();
+            functions.clear();
+            blocks.clear();
+            instrs.clear();
+            operands.clear();
+            preds.clear();
+            characters.clear();
+            error = {0, 0};
+        }
+
+        Name intern(std::string_view text) {
+            Name name{static_cast<uint32_t>(characters.size()), static_cast<uint32_t>(text.size())};
+            characters.append(text);
+            return name;
+        }
+
+        //Adds the name of the next slot, which Load and Store instructions refer to by number.
+        void add_name(std::string_view name) {
+            names.push_back(intern(name));
+        }
+
+        void set_error(std::string_view text) {
+            error = intern(text);
+        }
+
+        void add(const IRFunction& fn) {
+            uint32_t firstBlock = static_cast<uint32_t>(blocks.size());
+            std::unordered_map<const IRBlock*, uint32_t> index;
+            for (size_t b = 0; b < fn.blocks.size(); b++) {
+                index[fn.blocks[b].get()] = firstBlock + static_cast<uint32_t>(b);
+            }
+            // Values are numbered again in order, so a function has no more values than instructions.
+            std::unordered_map<const IRInstr*, uint32_t> value;
+            for (const auto& block : fn.blocks) {
+                for (const auto& instr : block->instrs) {
+                    value.emplace(instr.get(), static_cast<uint32_t>(value.size()));
+                }
+            }
+            functions.push_back({static_cast<uint32_t>(value.size()), firstBlock, static_cast<uint32_t>(fn.blocks.size())});
+            for (const auto& block : fn.blocks) {
+                blocks.push_back({static_cast<uint32_t>(block->id), static_cast<uint32_t>(instrs.size()), static_cast<uint32_t>(block->instrs.size()),
+                                  static_cast<uint32_t>(preds.size()), static_cast<uint32_t>(block->preds.size())});
+                for (const IRBlock* pred : block->preds) {
+                    preds.push_back(index.at(pred));
+                }
+                for (const auto& instr : block->instrs) {
+                    Instr flat{};
+                    flat.op = static_cast<uint8_t>(instr->op);
+                    flat.checked = instr->checked;
+                    flat.kind = instr->kind;
+                    flat.imm = instr->imm;
+                    flat.multiplier = instr->magic.multiplier;
+                    flat.shift = instr->magic.shift;
+                    flat.value = value.at(instr.get());
+                    flat.slot = static_cast<uint32_t>(instr->slot);
+                    flat.firstOperand = static_cast<uint32_t>(operands.size());
+                    flat.operandCount = static_cast<uint32_t>(instr->operands.size());
+                    for (const IRInstr* operand : instr->operands) {
+                        operands.push_back(value.at(operand));
+                    }
+                    for (size_t t = 0; t < instr->targets.size() && t < 2; t++) {
+                        flat.targets[t] = index.at(instr->targets[t]);
+                    }
+                    if (instr->op == IROp::Load) flat.name = intern(instr->name);
+                    instrs.push_back(flat);
+                }
+            }
+        }
+
+        //The IRCode of what has been added, valid until the writer changes.
+        IRCode view() const {
+            IRCode code;
+            code.counts = {static_cast<uint32_t>(names.size()), static_cast<uint32_t>(functions.size()), static_cast<uint32_t>(blocks.size()),
+                           static_cast<uint32_t>(instrs.size()), static_cast<uint32_t>(operands.size()), static_cast<uint32_t>(preds.size()),
+                           static_cast<uint32_t>(characters.size()), error};
+            code.names = names.data();
+            code.functions = functions.data();
+            code.blocks = blocks.data();
+            code.instrs = instrs.data();
+            code.operands = operands.data();
+            code.preds = preds.data();
+            code.characters = characters.data();
+            return code;
+        }
+
+        /*
+        Appends the image of what has been added to 'out': the Header, then each array. It is written as the interpreter holds it in
+        memory, with numbers in the byte order of the machine, so only the build of the interpreter that wrote an image can read it.
+        */
+        void write(std::string& out) const {
+            Header header = view().counts;
+            append(out, &header, 1);
+            append(out, names.data(), names.size());
+            append(out, functions.data(), functions.size());
+            append(out, blocks.data(), blocks.size());
+            append(out, instrs.data(), instrs.size());
+            append(out, operands.data(), operands.size());
+            append(out, preds.data(), preds.size());
+            out.append(characters);
+        }
+    };
+
+    /*
+    Views an image that Writer::write wrote at 'data', which must be 4-byte aligned, without copying it. Everything an index or a count
+    in it could reach is checked first, so a corrupt image fails here rather than while it runs.
+    */
+    static IRCode view(const char* data, size_t size) {
+        auto corrupt = [](const char* what) {
+            return std::runtime_error(std::string("Corrupt bundle: ") + what);
+        };
+        if (reinterpret_cast<uintptr_t>(data) % alignof(Header) != 0) throw corrupt("misaligned program");
+        if (size < sizeof(Header)) throw corrupt("truncated program");
+        IRCode code;
+        std::memcpy(&code.counts, data, sizeof(Header));
+        const Header& n = code.counts;
+        uint64_t expected = sizeof(Header) + uint64_t(n.names) * sizeof(Name) + uint64_t(n.functions) * sizeof(Function) +
+                            uint64_t(n.blocks) * sizeof(Block) + uint64_t(n.instrs) * sizeof(Instr) +
+                            (uint64_t(n.operands) + n.preds) * sizeof(uint32_t) + n.characters;
+        if (expected != size) throw corrupt("wrong program size");
+
+        const char* next = data + sizeof(Header);
+        auto take = [&](auto*& array, uint32_t count) {
+            array = reinterpret_cast<std::remove_reference_t<decltype(array)>>(next);
+            next += count * sizeof(*array);
+        };
+        take(code.names, n.names);
+        take(code.functions, n.functions);
+        take(code.blocks, n.blocks);
+        take(code.instrs, n.instrs);
+        take(code.operands, n.operands);
+        take(code.preds, n.preds);
+        code.characters = next;
+
+        auto valid_name = [&](Name name) {
+            return name.offset <= n.characters && name.length <= n.characters - name.offset;
+        };
+        if (!valid_name(n.error)) throw corrupt("bad name");
+        for (uint32_t k = 0; k < n.names; k++) {
+            if (!valid_name(code.names[k])) throw corrupt("bad name");
+        }
+        for (uint32_t f = 0; f < n.functions; f++) {
+            const Function& fn = code.functions[f];
+            if (fn.blockCount == 0 || fn.firstBlock > n.blocks || fn.blockCount > n.blocks - fn.firstBlock) {
+                throw corrupt("bad function");
+            }
+            auto in_function = [&](uint32_t block) {
+                return block >= fn.firstBlock && block - fn.firstBlock < fn.blockCount;
+            };
+            uint64_t instrCount = 0;
+            for (uint32_t b = fn.firstBlock; b < fn.firstBlock + fn.blockCount; b++) {
+                const Block& block = code.blocks[b];
+                if (block.instrCount == 0 || block.firstInstr > n.instrs || block.instrCount > n.instrs - block.firstInstr ||
+                    block.firstPred > n.preds || block.predCount > n.preds - block.firstPred) {
+                    throw corrupt("bad block");
+                }
+                for (uint32_t p = 0; p < block.predCount; p++) {
+                    if (!in_function(code.preds[block.firstPred + p])) throw corrupt("bad block");
+                }
+                instrCount += block.instrCount;
+                for (uint32_t k = 0; k < block.instrCount; k++) {
+                    const Instr& instr = code.instrs[block.firstInstr + k];
+                    if (instr.op > static_cast<uint8_t>(IROp::Return)) throw corrupt("bad instruction");
+                    IROp op = static_cast<IROp>(instr.op);
+                    bool terminator = op == IROp::Jump || op == IROp::Branch || op == IROp::Return;
+                    if (terminator != (k + 1 == block.instrCount)) throw corrupt("block without a terminator");
+                    if (instr.value >= fn.values) throw corrupt("bad value");
+                    uint32_t operandCount;
+                    switch (op) {
+                        case IROp::Store: case IROp::DivideByConstant: case IROp::ShiftLeft: case IROp::Copy: case IROp::Branch:
+                            operandCount = 1;
+                            break;
+                        case IROp::Binary: case IROp::Compare:
+                            operandCount = 2;
+                            break;
+                        case IROp::Phi:
+                            operandCount = block.predCount;
+                            break;
+                        case IROp::Print:
+                            operandCount = instr.operandCount ? 1 : 0;
+                            break;
+                        default:
+                            operandCount = 0;
+                    }
+                    if (instr.operandCount != operandCount || instr.firstOperand > n.operands || operandCount > n.operands - instr.firstOperand) {
+                        throw corrupt("bad operand");
+                    }
+                    for (uint32_t o = 0; o < operandCount; o++) {
+                        if (code.operands[instr.firstOperand + o] >= fn.values) throw corrupt("bad operand");
+                    }
+                    uint32_t targetCount = op == IROp::Jump ? 1 : op == IROp::Branch ? 2 : 0;
+                    for (uint32_t t = 0; t < targetCount; t++) {
+                        if (!in_function(instr.targets[t])) throw corrupt("bad block");
+                    }
+                    if ((op == IROp::Load || op == IROp::Store) && instr.slot >= n.names) throw corrupt("bad slot");
+                    if (op == IROp::Load && !valid_name(instr.name)) throw corrupt("bad name");
+                    if ((op == IROp::DivideByConstant && (instr.shift < 0 || instr.shift > 31)) ||
+                        (op == IROp::ShiftLeft && (instr.imm < 0 || instr.imm > 31))) {
+                        throw corrupt("bad shift");
+                    }
+                }
+            }
+            // The frame of a run holds every value, so a corrupt count must not make it huge.
+            if (fn.values > instrCount) throw corrupt("bad value");
+        }
+        return code;
+    }
+};
+
+/*
+Executes IR against the variables in a SymbolTable, or in anything else with its defined/value/set slot interface such as an Isolate's.
+Produces the same output and errors as the tree-walking Interpreter. It runs IRFunctions once they are flattened into IRCode. Running
+code doesn't change it, so threads can run the same IRCode at once.
+
+A run can yield and be resumed later. Every loop in the IR goes through an edge to a block that doesn't come later in the function, a
+back-edge, so yielding only there, once a slice of steps is used up, bounds how long a run goes between yields.
+*/
+template <typename Variables = SymbolTable>
+class IRInterpreter {
+private:
+    Variables& variables;
+    Printer& printer;
+    //Basic blocks entered so far, across every function run, and how many may be.
+    uint64_t steps = 0;
+    uint64_t stepLimit = UINT64_MAX;
+    //A run yields at the first back-edge it takes once 'steps' has reached this.
+    uint64_t yieldAt = UINT64_MAX;
+    std::vector<int> incoming;
+
+public:
+    //Where a run of one function stands: the block it enters next, the block it came from, and the values computed so far.
+    //A frame without a block has not started.
+    struct Frame {
+        uint32_t block = IRCode::none;
+        uint32_t previous = IRCode::none;
+        std::vector<int> values;
+    };
+
+    IRInterpreter(Variables& variables_, Printer& printer_) : variables(variables_), printer(printer_) {}
+
+    void limit_steps(uint64_t limit) {
+        stepLimit = limit;
+    }
+
+    //Lets the runs that follow go on for 'slice' more steps before they yield.
+    void yield_after(uint64_t slice) {
+        yieldAt = slice > UINT64_MAX - steps ? UINT64_MAX : steps + slice;
+    }
+
+    //Runs every function of 'code' in order, to the end, without yielding.
+    void run(const IRCode& code) {
+        Frame frame;
+        yieldAt = UINT64_MAX;
+        for (size_t function = 0; function < code.counts.functions; function++) {
+            run(code, function, frame);
+        }
+    }
+
+    //Starts or resumes a run of function 'function' of 'code' from 'frame'. Returns true once the function returns, leaving the frame
+    //ready for another run, or false if it yielded, with the frame holding where to resume.
+    bool run(const IRCode& code, size_t function, Frame& frame) {
+        std::vector<int>& values = frame.values;
+        uint32_t block = frame.block;
+        uint32_t previous = frame.previous;
+        if (block == IRCode::none) {
+            const IRCode::Function& fn = code.functions[function];
+            values.assign(fn.values, 0);
+            block = fn.firstBlock;
+            previous = IRCode::none;
+        }
+
+        while (true) {
+            const IRCode::Block& current = code.blocks[block];
+            if (previous != IRCode::none && current.id <= code.blocks[previous].id && steps >= yieldAt) {
+                frame.block = block;
+                frame.previous = previous;
+                return false;
+            }
+            if (++steps > stepLimit) {
+                throw std::runtime_error("Step limit exceeded");
+            }
+            const IRCode::Instr* instrs = code.instrs + current.firstInstr;
+            size_t k = 0;
+            if (previous != IRCode::none) {
+                // All phis of a block read their operands before any of them is written.
+                size_t edge = code.pred_index(current, previous);
+                incoming.clear();
+                for (; k < current.instrCount && instrs[k].op == static_cast<uint8_t>(IROp::Phi); k++) {
+                    incoming.push_back(values[code.operands[instrs[k].firstOperand + edge]]);
+                }
+                for (size_t p = 0; p < incoming.size(); p++) {
+                    values[instrs[p].value] = incoming[p];
+                }
+            }
+
+            bool transferred = false;
+            for (; k < current.instrCount && !transferred; k++) {
+                const IRCode::Instr& instr = instrs[k];
+                const uint32_t* args = code.operands + instr.firstOperand;
+                auto operand = [&](size_t n) {
+                    return values[args[n]];
+                };
+                int& out = values[instr.value];
+                switch (static_cast<IROp>(instr.op)) {
+                    case IROp::Const:
+                        out = instr.imm;
+                        break;
+                    case IROp::Undef:
+                        out = 0;
+                        break;
+                    case IROp::Load:
+                        if (!variables.defined(instr.slot)) {
+                            throw std::runtime_error("Undefined variable: " + std::string(code.text(instr.name)));
+                        }
+                        out = variables.value(instr.slot);
+                        break;
+                    case IROp::Store:
+                        variables.set(instr.slot, operand(0));
+                        break;
+                    case IROp::Binary:
+                        switch (instr.kind) {
+                            case PLUS: out = wrapping_add(operand(0), operand(1)); break;
+                            case MINUS: out = wrapping_sub(operand(0), operand(1)); break;
+                            case MUL: out = wrapping_mul(operand(0), operand(1)); break;
+                            case DIV: out = instr.checked ? checked_div(operand(0), operand(1)) : operand(0) / operand(1); break;
+                            default: throw std::runtime_error("Invalid binary operator");
+                        }
+                        break;
+                    case IROp::DivideByConstant:
+                        out = magic_divide(operand(0), instr.imm, DivisionMagic{instr.multiplier, instr.shift});
+                        break;
+                    case IROp::ShiftLeft:
+                        out = static_cast<int>(static_cast<uint32_t>(operand(0)) << instr.imm);
+                        break;
+                    case IROp::Compare:
+                        switch (instr.kind) {
+                            case EQUAL_TO: out = operand(0) == operand(1); break;
+                            case NOT_EQUAL_TO: out = operand(0) != operand(1); break;
+                            case GREATER_THAN: out = operand(0) > operand(1); break;
+                            case LESS_THAN: out = operand(0) < operand(1); break;
+                            case GREATER_THAN_OR_EQUAL_TO: out = operand(0) >= operand(1); break;
+                            case LESS_THAN_OR_EQUAL_TO: out = operand(0) <= operand(1); break;
+                            default: throw std::runtime_error("Invalid comparison operator");
+                        }
+                        break;
+                    case IROp::Copy:
+                        out = operand(0);
+                        break;
+                    case IROp::Print:
+                        if (instr.operandCount) {
+                            printer.value(operand(0));
+                        } else if (instr.imm) {
+                            printer.separator();
+                        } else {
+                            printer.end();
+                        }
+                        break;
+                    case IROp::Jump:
+                        previous = block;
+                        block = instr.targets[0];
+                        transferred = true;
+                        break;
+                    case IROp::Branch:
+                        previous = block;
+                        block = instr.targets[operand(0) ? 0 : 1];
+                        transferred = true;
+                        break;
+                    case IROp::Return:
+                        frame.block = IRCode::none;
+                        return true;
+                    case IROp::Phi:
+                        throw std::runtime_error("IR: phi after the start of a block");
+                }
+            }
+        }
+    }
+};
+
+/*
+Folds operators whose operands are all constants, and drops the if and while statements whose condition is constant. FullUnrolling
+runs it again over each copy of a loop body, where the substituted loop counter is what usually makes operands constant. Divisions by
+zero are left for the Interpreter to report.
+*/
+class ConstantFolding : public ASTPass {
+private:
+    OptimizationStats& stats;
+
+    static std::optional<int> constant(const std::unique_ptr<AST>& node) {
+        if (auto number = dynamic_cast<NumberNode*>(node.get())) {
+            return number->value;
+        }
+        return std::nullopt;
+    }
+
+    void fold(int value) {
+        replacement = std::make_unique<NumberNode>(value);
+        stats.expressionsFolded++;
+    }
+
+public:
+    explicit ConstantFolding(OptimizationStats& stats_) : stats(stats_) {}
+
+    void visit(BinaryOpNode* node) override {
+        ASTPass::visit(node);
+        std::optional<int> left = constant(node->left);
+        std::optional<int> right = constant(node->right);
+        if (!left || !right) return;
+
+        switch (node->op) {
+            case PLUS: fold(wrapping_add(*left, *right)); break;
+            case MINUS: fold(wrapping_sub(*left, *right)); break;
+            case MUL: fold(wrapping_mul(*left, *right)); break;
+            case DIV:
+                if (*right != 0) fold(checked_div(*left, *right));
+                break;
+            default: break;
+        }
+    }
+
+    void visit(ComparisonNode* node) override {
+        ASTPass::visit(node);
+        std::optional<int> left = constant(node->left);
+        std::optional<int> right = constant(node->right);
+        if (left && right) {
+            fold(compare_values(node->op, *left, *right));
+        }
+    }
+
+    //Follows the Interpreter's short-circuiting, so a constant left operand can decide the result on its own.
+    void visit(LogicalOpNode* node) override {
+        ASTPass::visit(node);
+        std::optional<int> left = constant(node->left);
+        if (!left) return;
+        if (node->op == AND && !*left) {
+            fold(false);
+        } else if (node->op == OR && *left) {
+            fold(true);
+        } else if (std::optional<int> right = constant(node->right)) {
+            fold(*right != 0);
+        }
+    }
+
+    bool expand(std::unique_ptr<AST>& statement, std::vector<std::unique_ptr<AST>>& out) override {
+        if (auto branch = dynamic_cast<IfNode*>(statement.get())) {
+            std::optional<int> condition = constant(branch->condition);
+            if (!condition) return false;
+            if (*condition) {
+                for (auto& stmt : branch->body) {
+                    out.push_back(std::move(stmt));
+                }
+            }
+            stats.statementsFolded++;
+            return true;
+        }
+        if (auto loop = dynamic_cast<WhileNode*>(statement.get())) {
+            std::optional<int> condition = constant(loop->condition);
+            if (!condition || *condition) return false;
+            stats.statementsFolded++;
+            return true;
+        }
+        return false;
+    }
+};
+
+/*
+Fully unrolls for loops with constant bounds and a small trip count. Only loops inside another statement's body are unrolled, since that
+is where their setup runs repeatedly (and a top-level statement can't be replaced by several). Each copy of the body reads the loop
+variable as a constant and is constant folded again, and a final assignment leaves the variable holding 'end' as the loop would. Loops
+that write their own variable are left alone.
+*/
+class FullUnrolling : public ASTPass {
+private:
+    static constexpr int64_t maxTrips = 8;
+    static constexpr int64_t maxNodes = 128;
+    OptimizationStats& stats;
+
+public:
+    explicit FullUnrolling(OptimizationStats& stats_) : stats(stats_) {}
+
+    bool expand(std::unique_ptr<AST>& statement, std::vector<std::unique_ptr<AST>>& out) override {
+        auto loop = dynamic_cast<ForNode*>(statement.get());
+        if (!loop || loop->countedWhile || loop->unroll > 1) return false;
+        auto start = dynamic_cast<NumberNode*>(loop->start.get());
+        auto end = dynamic_cast<NumberNode*>(loop->end.get());
+        if (!start || !end) return false;
+
+        int64_t trips = static_cast<int64_t>(end->value) - start->value + 1;
+        if (trips <= 0) {
+            stats.loopsFullyUnrolled++;
+            return true;
+        }
+        if (trips > maxTrips) return false;
+
+        NodeCount size(maxNodes / trips);
+        size.run(loop->body);
+        if (size.exceeded()) return false;
+        AssignedVariables assigned;
+        assigned.run(loop->body);
+        if (assigned.names.count(loop->var_name)) return false;
+
+        for (int64_t k = 0; k < trips; k++) {
+            int i = static_cast<int>(start->value + k);
+            ASTCloner cloner;
+            cloner.constants[loop->var_name] = i;
+            for (const auto& d : loop->derived) {
+                cloner.constants[d.name] = wrapping_mul(i, d.factor);
+            }
+            std::vector<std::unique_ptr<AST>> copies = cloner.clone(loop->body);
+            ConstantFolding(stats).run_body(copies);
+            for (auto& copy : copies) {
+                out.push_back(std::move(copy));
+            }
+        }
+        out.push_back(std::make_unique<AssignNode>(loop->var_name, std::make_unique<NumberNode>(end->value)));
+        stats.loopsFullyUnrolled++;
+        return true;
+    }
+};
+
+/*
+Compiles the bodies of reduction loops into ReductionKernels (see there). E and C may use the loop counter, its derived induction
+variables, constants, and variables the body doesn't write; division is left to the tree, since it can fail and has no lane instruction.
+*/
+class ReductionVectorizer : public ASTPass {
+private:
+    OptimizationStats& stats;
+    SymbolTable& symbolTable;
+
+    struct Compiler {
+        ForNode* loop;
+        SymbolTable& symbolTable;
+        const std::string& accumulator;
+        ReductionKernel kernel;
+
+        int emit(ReductionKernel::Instr instr) {
+            if (kernel.code.size() >= ReductionKernel::maxInstrs) return -1;
+            kernel.code.push_back(instr);
+            return static_cast<int>(kernel.code.size()) - 1;
+        }
+
+        int emit(ReductionKernel::Op op, int a, int b) {
+            if (a < 0 || b < 0) return -1;
+            return emit({op, a, b});
+        }
+
+        int variable(const std::string& name) {
+            if (name == accumulator) return -1;
+            if (name == loop->var_name) return emit({ReductionKernel::Op::Counter});
+            for (const auto& d : loop->derived) {
+                if (d.name == name) {
+                    int counter = emit({ReductionKernel::Op::Counter});
+                    int factor = emit({ReductionKernel::Op::Constant, 0, 0, d.factor});
+                    return emit(ReductionKernel::Op::Mul, counter, factor);
+                }
+            }
+            size_t slot = symbolTable.slot(name);
+            auto it = std::find(kernel.invariants.begin(), kernel.invariants.end(), slot);
+            int index = static_cast<int>(it - kernel.invariants.begin());
+            if (it == kernel.invariants.end()) kernel.invariants.push_back(slot);
+            return emit({ReductionKernel::Op::Invariant, 0, 0, index});
+        }
+
+        int expression(const std::unique_ptr<AST>& node) {
+            if (auto number = dynamic_cast<NumberNode*>(node.get())) {
+                return emit({ReductionKernel::Op::Constant, 0, 0, number->value});
+            }
+            if (auto variable = dynamic_cast<VariableNode*>(node.get())) {
+                return this->variable(variable->name);
+            }
+            if (auto shift = dynamic_cast<ShiftLeftNode*>(node.get())) {
+                int left = expression(shift->left);
+                return left < 0 ? -1 : emit({ReductionKernel::Op::Shl, left, 0, shift->shift});
+            }
+            auto op = dynamic_cast<BinaryOpNode*>(node.get());
+            if (!op) return -1;
+            int left = expression(op->left);
+            int right = expression(op->right);
+            switch (op->op) {
+                case PLUS: return emit(ReductionKernel::Op::Add, left, right);
+                case MINUS: return emit(ReductionKernel::Op::Sub, left, right);
+                case MUL: return emit(ReductionKernel::Op::Mul, left, right);
+                default: return -1;
+            }
+        }
+
+        int condition(const std::unique_ptr<AST>& node) {
+            if (auto comparison = dynamic_cast<ComparisonNode*>(node.get())) {
+                int left = expression(comparison->left);
+                int right = expression(comparison->right);
+                if (left < 0 || right < 0) return -1;
+                ReductionKernel::Instr instr{ReductionKernel::Op::Compare, left, right};
+                instr.compare = comparison->op;
+                return emit(instr);
+            }
+            if (auto logical = dynamic_cast<LogicalOpNode*>(node.get())) {
+                int left = condition(logical->left);
+                int right = condition(logical->right);
+                return emit(logical->op == AND ? ReductionKernel::Op::And : ReductionKernel::Op::Or, left, right);
+            }
+            int value = expression(node);
+            return value < 0 ? -1 : emit({ReductionKernel::Op::NotZero, value});
+        }
+    };
+
+    struct Term {
+        const std::unique_ptr<AST>* node;
+        bool negative;
+    };
+
+    //Splits a sum into its terms. Wrapping addition is associative, so acc + a - b can be regrouped as acc + (a - b) exactly.
+    static void split_terms(const std::unique_ptr<AST>& node, bool negative, std::vector<Term>& terms) {
+        auto sum = dynamic_cast<BinaryOpNode*>(node.get());
+        if (sum && (sum->op == PLUS || sum->op == MINUS)) {
+            split_terms(sum->left, negative, terms);
+            split_terms(sum->right, sum->op == MINUS ? !negative : negative, terms);
+        } else {
+            terms.push_back({&node, negative});
+        }
+    }
+
+    //The terms added to the accumulator, if 'assign' is acc = (a sum with exactly one term acc, added rather than subtracted).
+    static std::optional<std::vector<Term>> accumulation(AssignNode* assign) {
+        std::vector<Term> terms;
+        split_terms(assign->value, false, terms);
+        std::vector<Term> others;
+        int accumulatorTerms = 0;
+        for (const Term& term : terms) {
+            auto variable = dynamic_cast<VariableNode*>(term.node->get());
+            if (variable && variable->name == assign->name) {
+                if (term.negative) return std::nullopt;
+                accumulatorTerms++;
+            } else {
+                others.push_back(term);
+            }
+        }
+        if (accumulatorTerms != 1 || others.empty()) return std::nullopt;
+        return others;
+    }
+
+public:
+    ReductionVectorizer(OptimizationStats& stats_, SymbolTable& symbolTable_) : stats(stats_), symbolTable(symbolTable_) {}
+
+    void visit(ForNode* node) override {
+        ASTPass::visit(node);
+        if (node->reduction || node->unroll > 1 || node->body.size() != 1) return;
+
+        AST* statement = node->body[0].get();
+        IfNode* guard = dynamic_cast<IfNode*>(statement);
+        if (guard) {
+            if (guard->body.size() != 1) return;
+            statement = guard->body[0].get();
+        }
+        auto assign = dynamic_cast<AssignNode*>(statement);
+        if (!assign || assign->name == node->var_name) return;
+        for (const auto& d : node->derived) {
+            if (d.name == assign->name) return;
+        }
+        std::optional<std::vector<Term>> terms = accumulation(assign);
+        if (!terms) return;
+
+        Compiler compiler{node, symbolTable, assign->name, {}};
+        int value = compiler.emit({ReductionKernel::Op::Constant, 0, 0, 0});
+        for (const Term& term : *terms) {
+            value = compiler.emit(term.negative ? ReductionKernel::Op::Sub : ReductionKernel::Op::Add, value, compiler.expression(*term.node));
+        }
+        if (value < 0) return;
+        compiler.kernel.value = value;
+        if (guard) {
+            compiler.kernel.guard = compiler.condition(guard->condition);
+            if (compiler.kernel.guard < 0) return;
+        }
+        compiler.kernel.accumulator = symbolTable.slot(assign->name);
+        node->reduction = std::make_shared<const ReductionKernel>(std::move(compiler.kernel));
+        stats.reductionsVectorized++;
+    }
+};
+
+/*
+Marks the and/or operators whose operands can be evaluated in either order (see LogicalOpNode). Runs after RangeAnalysis, which
+clears the checks on variable reads and divisions that can't fail; an operand with any check left might fail, and is kept in place.
+So is a right operand whose checks were only cleared because the left operand runs first and narrows or defines its variables.
+*/
+class ConditionReordering : public ASTPass {
+private:
+    OptimizationStats& stats;
+
+    //Counts the nodes of an operand and whether any of them can fail.
+    class OperandScan : public ASTPass {
+    public:
+        int cost = 0;
+        bool canFail = false;
+
+        void visit(BinaryOpNode* node) override {
+            cost++;
+            if (node->op == DIV && node->checkDivisor) canFail = true;
+            ASTPass::visit(node);
+        }
+
+        void visit(NumberNode*) override {
+            cost++;
+        }
+
+        void visit(VariableNode* node) override {
+            cost++;
+            if (node->checkDefined) canFail = true;
+        }
+
+        void visit(ComparisonNode* node) override {
+            cost++;
+            ASTPass::visit(node);
+        }
+
+        void visit(LogicalOpNode* node) override {
+            cost++;
+            ASTPass::visit(node);
+        }
+
+        void visit(DivideByConstantNode* node) override {
+            cost++;
+            ASTPass::visit(node);
+        }
+
+        void visit(ShiftLeftNode* node) override {
+            cost++;
+            ASTPass::visit(node);
+        }
+    };
+
+public:
+    explicit ConditionReordering(OptimizationStats& stats_) : stats(stats_) {}
+
+    void visit(LogicalOpNode* node) override {
+        ASTPass::visit(node);
+        OperandScan left, right;
+        left.run(node->left);
+        right.run(node->right);
+        if (left.canFail || right.canFail || node->rightNeedsLeft) return;
+        node->reorderable = true;
+        node->leftCost = left.cost;
+        node->rightCost = right.cost;
+        stats.reorderableConditions++;
+    }
+};
+
+/*
+Partially unrolls for loops by 'factor'. The Interpreter runs whole chunks of 'factor' iterations through unrolledBody, setting the loop
+variable once per chunk, and runs the remaining iterations on the original body. Copy j reads the loop variable as 'var + j * step' and
+each derived induction variable as 'name + factor * j * step', so loops that write their own variable are skipped. Runs after RangeAnalysis: every
+copy starts in a state the loop body can already start in, so the flags the analysis set stay valid in the copies.
+*/
+class PartialUnrolling : public ASTPass {
+private:
+    static constexpr int64_t maxNodes = 256;
+    OptimizationStats& stats;
+    int factor;
+
+public:
+    PartialUnrolling(OptimizationStats& stats_, int factor_) : stats(stats_), factor(factor_) {}
+
+    void visit(ForNode* node) override {
+        ASTPass::visit(node);
+        if (factor < 2 || node->unroll > 1 || node->reduction) return;
+        auto start = dynamic_cast<NumberNode*>(node->start.get());
+        auto end = dynamic_cast<NumberNode*>(node->end.get());
+        if (start && end && static_cast<int64_t>(end->value) - start->value + 1 < factor) return;
+
+        NodeCount size(maxNodes / factor);
+        size.run(node->body);
+        if (size.exceeded()) return;
+        AssignedVariables assigned;
+        assigned.run(node->body);
+        if (assigned.names.count(node->var_name)) return;
+
+        for (int j = 0; j < factor; j++) {
+            ASTCloner cloner;
+            cloner.offsets[node->var_name] = wrapping_mul(node->step, j);
+            for (const auto& d : node->derived) {
+                cloner.offsets[d.name] = wrapping_mul(d.factor, wrapping_mul(node->step, j));
+            }
+            for (auto& copy : cloner.clone(node->body)) {
+                node->unrolledBody.push_back(std::move(copy));
+            }
+        }
+        node->unroll = factor;
+        stats.loopsPartiallyUnrolled++;
+    }
+};
+
+/*
+Rewrites counter-driven while loops into counted ForNodes, so they get the for loop fast paths:
+    while x op B then ... x = x + c end
+where op is <, <=, > or >=, the last statement of the body steps x toward B by a constant, nothing else in the body writes x, and B
+reads no variable the body writes. The ForNode behaves exactly like the while loop: it reads x and then B once, as the first test did,
+tests 'x op B' before every iteration, steps with wrapping arithmetic, and leaves x at the first value that fails the test.
+*/
+class CountedLoops : public ASTPass {
+private:
+    OptimizationStats& stats;
+
+    //The constant a statement of the form x = x + c, x = c + x or x = x - c adds to x.
+    static std::optional<int> step_of(const std::unique_ptr<AST>& statement, const std::string& name) {
+        auto assign = dynamic_cast<AssignNode*>(statement.get());
+        if (!assign || assign->name != name) return std::nullopt;
+        auto sum = dynamic_cast<BinaryOpNode*>(assign->value.get());
+        if (!sum || (sum->op != PLUS && sum->op != MINUS)) return std::nullopt;
+
+        auto leftVariable = dynamic_cast<VariableNode*>(sum->left.get());
+        auto rightVariable = dynamic_cast<VariableNode*>(sum->right.get());
+        auto leftNumber = dynamic_cast<NumberNode*>(sum->left.get());
+        auto rightNumber = dynamic_cast<NumberNode*>(sum->right.get());
+        if (leftVariable && leftVariable->name == name && rightNumber) {
+            return sum->op == PLUS ? rightNumber->value : wrapping_sub(0, rightNumber->value);
+        }
+        if (sum->op == PLUS && rightVariable && rightVariable->name == name && leftNumber) {
+            return leftNumber->value;
+        }
+        return std::nullopt;
+    }
+
+public:
+    explicit CountedLoops(OptimizationStats& stats_) : stats(stats_) {}
+
+    void visit(WhileNode* node) override {
+        ASTPass::visit(node);
+        auto comparison = dynamic_cast<ComparisonNode*>(node->condition.get());
+        if (!comparison || node->body.empty()) return;
+        auto counter = dynamic_cast<VariableNode*>(comparison->left.get());
+        if (!counter) return;
+
+        bool ascending;
+        switch (comparison->op) {
+            case LESS_THAN:
+            case LESS_THAN_OR_EQUAL_TO:
+                ascending = true;
+                break;
+            case GREATER_THAN:
+            case GREATER_THAN_OR_EQUAL_TO:
+                ascending = false;
+                break;
+            default:
+                return;
+        }
+        std::optional<int> step = step_of(node->body.back(), counter->name);
+        if (!step || *step == 0 || (*step > 0) != ascending) return;
+
+        AssignedVariables assigned;
+        for (size_t k = 0; k + 1 < node->body.size(); k++) {
+            assigned.run(node->body[k]);
+        }
+        if (assigned.names.count(counter->name)) return;
+        ReadVariables bound;
+        bound.run(comparison->right);
+        for (const auto& name : bound.names) {
+            if (name == counter->name || assigned.names.count(name)) return;
+        }
+
+        node->body.pop_back();
+        auto loop = std::make_unique<ForNode>(counter->name, std::move(comparison->left), std::move(comparison->right), std::move(node->body));
+        loop->line = node->line;
+        loop->countedWhile = true;
+        loop->test = comparison->op;
+        loop->step = *step;
+        replacement = std::move(loop);
+        stats.whileLoopsCounted++;
+    }
+};
+
+/*
+Fuses adjacent for loops over the same variable and the same bounds into one loop, running the second body right after the first in
+every iteration. That is only done when it can't be observed:
+- Neither body writes the loop variable, and the second loop's bounds can't be changed by the first body.
+- The bodies are independent: neither writes a variable the other reads or writes.
+- At most one body has effects (printing, a runtime error, or a while loop that might not terminate), so output and errors stay in order.
+'entry' is the abstract state before the top-level statement; a variable defined there stays defined, so reading it can't fail.
+*/
+class LoopFusion : public ASTPass {
+private:
+    //Collects the variables a loop body reads and whether it has effects.
+    class BodySummary : public ASTPass {
+    private:
+        const AbstractState& entry;
+        std::vector<std::string> counters;
+
+    public:
+        std::unordered_set<std::string> reads;
+        bool effects = false;
+
+        BodySummary(const AbstractState& entry_, const std::string& counter) : entry(entry_), counters{counter} {}
+
+        void visit(VariableNode* node) override {
+            reads.insert(node->name);
+            if (!entry.defined(node->name) && std::find(counters.begin(), counters.end(), node->name) == counters.end()) {
+                effects = true;
+            }
+        }
+
+        void visit(BinaryOpNode* node) override {
+            ASTPass::visit(node);
+            auto divisor = dynamic_cast<NumberNode*>(node->right.get());
+            if (node->op == DIV && (!divisor || divisor->value == 0)) effects = true;
+        }
+
+        void visit(PrintNode* node) override {
+            effects = true;
+            ASTPass::visit(node);
+        }
+
+        void visit(WhileNode* node) override {
+            effects = true;
+            ASTPass::visit(node);
+        }
+
+        void visit(ForNode* node) override {
+            run(node->start);
+            run(node->end);
+            counters.push_back(node->var_name);
+            run_body(node->body);
+            counters.pop_back();
+        }
+    };
+
+    OptimizationStats& stats;
+    const AbstractState& entry;
+
+    //True if two bound expressions are the same arithmetic on variables the first loop leaves unchanged, so they evaluate equally.
+    static bool same_bound(const std::unique_ptr<AST>& a, const std::unique_ptr<AST>& b, const std::unordered_set<std::string>& written) {
+        auto numberA = dynamic_cast<NumberNode*>(a.get());
+        auto numberB = dynamic_cast<NumberNode*>(b.get());
+        if (numberA || numberB) return numberA && numberB && numberA->value == numberB->value;
+        auto variableA = dynamic_cast<VariableNode*>(a.get());
+        auto variableB = dynamic_cast<VariableNode*>(b.get());
+        if (variableA || variableB) return variableA && variableB && variableA->name == variableB->name && !written.count(variableA->name);
+        auto opA = dynamic_cast<BinaryOpNode*>(a.get());
+        auto opB = dynamic_cast<BinaryOpNode*>(b.get());
+        return opA && opB && opA->op == opB->op && same_bound(opA->left, opB->left, written) && same_bound(opA->right, opB->right, written);
+    }
+
+    static bool intersects(const std::unordered_set<std::string>& a, const std::unordered_set<std::string>& b) {
+        for (const auto& name : a) {
+            if (b.count(name)) return true;
+        }
+        return false;
+    }
+
+    void fuse_adjacent(std::vector<std::unique_ptr<AST>>& statements) {
+        std::vector<std::unique_ptr<AST>> result;
+        for (auto& statement : statements) {
+            if (!result.empty() && fuse(result.back(), statement)) continue;
+            result.push_back(std::move(statement));
+        }
+        statements = std::move(result);
+    }
+
+public:
+    LoopFusion(OptimizationStats& stats_, const AbstractState& entry_) : stats(stats_), entry(entry_) {}
+
+    //Merges 'second' into 'first' if both are fusable loops. Returns true if 'second' was absorbed.
+    bool fuse(std::unique_ptr<AST>& first, std::unique_ptr<AST>& second) {
+        auto a = dynamic_cast<ForNode*>(first.get());
+        auto b = dynamic_cast<ForNode*>(second.get());
+        if (!a || !b || a->var_name != b->var_name || a->countedWhile || b->countedWhile || a->unroll > 1 || b->unroll > 1) return false;
+
+        AssignedVariables writesA, writesB;
+        writesA.run(a->body);
+        writesB.run(b->body);
+        if (writesA.names.count(a->var_name) || writesB.names.count(b->var_name)) return false;
+        std::unordered_set<std::string> changedByA = writesA.names;
+        changedByA.insert(a->var_name);
+        if (!same_bound(a->start, b->start, changedByA) || !same_bound(a->end, b->end, changedByA)) return false;
+
+        BodySummary summaryA(entry, a->var_name), summaryB(entry, b->var_name);
+        summaryA.run(a->body);
+        summaryB.run(b->body);
+        if (summaryA.effects && summaryB.effects) return false;
+        if (intersects(writesA.names, summaryB.reads) || intersects(writesA.names, writesB.names) ||
+            intersects(writesB.names, summaryA.reads)) {
+            return false;
+        }
+
+        for (auto& stmt : b->body) {
+            a->body.push_back(std::move(stmt));
+        }
+        for (const auto& d : b->derived) {
+            auto same = [&](const ForNode::DerivedInduction& other) { return other.name == d.name; };
+            if (std::none_of(a->derived.begin(), a->derived.end(), same)) a->derived.push_back(d);
+        }
+        fuse_adjacent(a->body);
+        stats.loopsFused++;
+        return true;
+    }
+
+    void visit(IfNode* node) override {
+        ASTPass::visit(node);
+        fuse_adjacent(node->body);
+    }
+
+    void visit(WhileNode* node) override {
+        ASTPass::visit(node);
+        fuse_adjacent(node->body);
+    }
+
+    void visit(ForNode* node) override {
+        ASTPass::visit(node);
+        fuse_adjacent(node->body);
+    }
+};
+
+/*
+Peephole pass that fuses common statement shapes into superinstructions:
+- x = x + K, x = K + x and x = x - K become IncrementNodes.
+- x = y + z with variables y and z becomes an AddVariablesNode.
+- if v op K then / while v op K then (or K op v) become CompareConstantIfNode / CompareConstantWhileNode.
+The fused nodes cache slots and constants taken from their children, so this must be the last pass to change the AST.
+*/
+class Superinstructions : public ASTPass {
+private:
+    OptimizationStats& stats;
+    SymbolTable& symbolTable;
+
+    static VariableNode* variable(const std::unique_ptr<AST>& node) {
+        return dynamic_cast<VariableNode*>(node.get());
+    }
+
+    static NumberNode* number(const std::unique_ptr<AST>& node) {
+        return dynamic_cast<NumberNode*>(node.get());
+    }
+
+    std::optional<VariableConstantTest> match_test(const std::unique_ptr<AST>& condition) {
+        auto comparison = dynamic_cast<ComparisonNode*>(condition.get());
+        if (!comparison) return std::nullopt;
+        if (variable(comparison->left) && number(comparison->right)) {
+            VariableNode* v = variable(comparison->left);
+            return VariableConstantTest{symbolTable.slot(v->name), comparison->op, number(comparison->right)->value, v->checkDefined};
+        }
+        if (number(comparison->left) && variable(comparison->right)) {
+            VariableNode* v = variable(comparison->right);
+            TokenType mirrored = comparison->op;
+            switch (comparison->op) {
+                case GREATER_THAN: mirrored = LESS_THAN; break;
+                case LESS_THAN: mirrored = GREATER_THAN; break;
+                case GREATER_THAN_OR_EQUAL_TO: mirrored = LESS_THAN_OR_EQUAL_TO; break;
+                case LESS_THAN_OR_EQUAL_TO: mirrored = GREATER_THAN_OR_EQUAL_TO; break;
+                default: break;
+            }
+            return VariableConstantTest{symbolTable.slot(v->name), mirrored, number(comparison->left)->value, v->checkDefined};
+        }
+        return std::nullopt;
+    }
+
+public:
+    Superinstructions(OptimizationStats& stats_, SymbolTable& symbolTable_) : stats(stats_), symbolTable(symbolTable_) {}
+
+    void visit(AssignNode* node) override {
+        ASTPass::visit(node);
+        auto sum = dynamic_cast<BinaryOpNode*>(node->value.get());
+        if (!sum || (sum->op != PLUS && sum->op != MINUS)) return;
+        size_t slot = symbolTable.slot(node->name);
+
+        VariableNode* left = variable(sum->left);
+        VariableNode* right = variable(sum->right);
+        if (left && left->name == node->name && number(sum->right)) {
+            int k = number(sum->right)->value;
+            int delta = sum->op == PLUS ? k : wrapping_sub(0, k);
+            replacement = std::make_unique<IncrementNode>(std::move(*node), slot, delta, left->checkDefined);
+            stats.increments++;
+        } else if (sum->op == PLUS && right && right->name == node->name && number(sum->left)) {
+            replacement = std::make_unique<IncrementNode>(std::move(*node), slot, number(sum->left)->value, right->checkDefined);
+            stats.increments++;
+        } else if (sum->op == PLUS && left && right) {
+            size_t leftSlot = symbolTable.slot(left->name);
+            size_t rightSlot = symbolTable.slot(right->name);
+            replacement = std::make_unique<AddVariablesNode>(std::move(*node), slot, leftSlot, rightSlot, left->checkDefined, right->checkDefined);
+            stats.variableAdditions++;
+        }
+    }
+
+    void visit(IfNode* node) override {
+        ASTPass::visit(node);
+        if (auto test = match_test(node->condition)) {
+            replacement = std::make_unique<CompareConstantIfNode>(std::move(*node), *test);
+            stats.compareBranches++;
+        }
+    }
+
+    void visit(WhileNode* node) override {
+        ASTPass::visit(node);
+        if (auto test = match_test(node->condition)) {
+            replacement = std::make_unique<CompareConstantWhileNode>(std::move(*node), *test);
+            stats.compareBranches++;
+        }
+    }
+};
+
+/* Runs the optimization passes over each top-level statement after it is parsed and before it is executed. */
+class Optimizer {
+private:
+    OptimizationStats stats;
+    AbstractState programState;
+    AbstractState statementEntry;
+    SymbolTable& symbolTable;
+    bool enabled;
+    int unrollFactor;
+    //Set under --tiered, where statements run as parsed and only hot loops are optimized.
+    bool deferred = false;
+
+    void run_passes(std::unique_ptr<AST>& ast) {
+        CountedLoops(stats).run(ast);
+        LoopFusion(stats, programState).run(ast);
+        ConstantFolding(stats).run(ast);
+        FullUnrolling(stats).run(ast);
+        StrengthReduction(stats).run(ast);
+        programState = RangeAnalysis(stats, programState).analyze(ast);
+        ReductionVectorizer(stats, symbolTable).run(ast);
+        PartialUnrolling(stats, unrollFactor).run(ast);
+        //Compiles the copies of inner reduction loops that unrolling made, whose kernels the cloner dropped.
+        ReductionVectorizer(stats, symbolTable).run(ast);
+        ConditionReordering(stats).run(ast);
+        Superinstructions(stats, symbolTable).run(ast);
+    }
+
+public:
+    Optimizer(SymbolTable& symbolTable_, bool enabled_, int unrollFactor_)
+        : symbolTable(symbolTable_), enabled(enabled_), unrollFactor(unrollFactor_) {}
+
+    //Leaves the statements as parsed, for compile_loop() to optimize the loops that get hot.
+    void defer_to_tiers() {
+        deferred = true;
+    }
+
+    void optimize(std::unique_ptr<AST>& ast) {
+        statementEntry = programState;
+        if (!enabled || deferred) return;
+        // The passes can't see into a lazy body, so the statement runs as parsed. It may assign any variable, but can't undefine one.
+        if (has_lazy_body(ast.get())) {
+            for (auto& [name, var] : programState.vars) {
+                var.range = Interval::top();
+            }
+            return;
+        }
+        run_passes(ast);
+    }
+
+    /*
+    Optimizes a copy of a loop that got hot under --tiered. It runs in the middle of the program, where nothing is known about the
+    variables, so the passes start from an empty state like they do for a lazy body.
+    */
+    void compile_loop(std::unique_ptr<AST>& loop, bool midRun) {
+        AbstractState outer = std::move(programState);
+        programState = AbstractState();
+        run_passes(loop);
+        programState = std::move(outer);
+        stats.loopsTieredUp++;
+        if (midRun) stats.onStackReplacements++;
+    }
+
+    /*
+    Optimizes a statement parsed from a lazy body when the body first runs. Nothing is known about the variables there, so the passes
+    start from an empty state, and what they learn doesn't carry over to the top-level statements.
+    */
+    void optimize_body(std::unique_ptr<AST>& ast) {
+        AbstractState outer = std::move(programState);
+        AbstractState outerEntry = std::move(statementEntry);
+        programState = AbstractState();
+        optimize(ast);
+        programState = std::move(outer);
+        statementEntry = std::move(outerEntry);
+    }
+
+    //Whether a statement holds a lazy body. The parser only leaves them in the bodies of if statements.
+    static bool has_lazy_body(const AST* node) {
+        auto branch = dynamic_cast<const IfNode*>(node);
+        if (!branch) return false;
+        return std::any_of(branch->body.begin(), branch->body.end(), [](const std::unique_ptr<AST>& stmt) {
+            return dynamic_cast<const LazyBodyNode*>(stmt.get()) || has_lazy_body(stmt.get());
+        });
+    }
+
+    //Fuses the next top-level statement into the one before it when both are fusable loops. Returns true if 'next' was absorbed.
+    bool fuse(std::unique_ptr<AST>& ast, std::unique_ptr<AST>& next) {
+        return enabled && !deferred && LoopFusion(stats, programState).fuse(ast, next);
+    }
+
+    //Lowers the statement last passed to optimize() into SSA form, then runs the IR passes over it.
+    IRFunction lower(const std::unique_ptr<AST>& ast) {
+        IRFunction fn = IRLowering(statementEntry).lower_statement(ast);
+        PassManager passes;
+        if (enabled) {
+            passes.add(std::make_unique<CopyPropagation>(stats));
+            passes.add(std::make_unique<SparseConditionalConstantPropagation>(stats));
+            passes.add(std::make_unique<CopyPropagation>(stats));
+            passes.add(std::make_unique<DeadCodeElimination>());
+        }
+        passes.run(fn);
+        for (auto& block : fn.blocks) {
+            for (auto& instr : block->instrs) {
+                if (instr->op == IROp::Load || instr->op == IROp::Store) {
+                    instr->slot = symbolTable.slot(instr->name);
+                }
+            }
+        }
+        return fn;
+    }
+
+    const OptimizationStats& statistics() const {
+        return stats;
+    }
+};
+
+//Compiles the loops that get hot under --tiered by copying them and running the Optimizer over the copy.
+class LoopCompiler : public Tiering {
+private:
+    Optimizer& optimizer;
+
+public:
+    LoopCompiler(Optimizer& optimizer_, uint64_t threshold_) : Tiering(threshold_), optimizer(optimizer_) {}
+
+    std::unique_ptr<AST> compile(AST* loop, bool midRun) override {
+        ASTCloner cloner;
+        std::unique_ptr<AST> copy = cloner.clone(loop);
+        optimizer.compile_loop(copy, midRun);
+        return copy;
+    }
+
+    std::unique_ptr<AST> compile_rest(ForNode* loop, int next, int end) override {
+        ASTCloner cloner;
+        std::unique_ptr<AST> rest = std::make_unique<ForNode>(loop->var_name, std::make_unique<NumberNode>(next),
+                                                              std::make_unique<NumberNode>(end), cloner.clone(loop->body));
+        rest->line = loop->line;
+        optimizer.compile_loop(rest, true);
+        return rest;
+    }
+};
+
+//Command line options. Any argument that does not start with '-' is the source file.
+struct Options {
+    std::string file_path;
+    bool optimize = true;
+    bool optReport = false;
+    bool dumpIR = false;
+    std::string engine = "ast";
+    int unroll = 4;
+    bool asyncOutput = false;
+    std::string outputFormat = "text";
+    std::string tracePath;
+    bool allocReport = false;
+    bool loopStats = false;
+    std::string benchDir;
+    std::string baselinePath;
+    std::string saveBaselinePath;
+    int benchRuns = 20;
+    double benchThreshold = 10;
+    size_t stackSize = size_t(1) << 30;
+    std::string inputsPath;
+    unsigned threads = 0;
+    uint64_t maxSteps = UINT64_MAX;
+    size_t maxOutput = SIZE_MAX;
+    uint64_t slice = 10000;
+    bool bundle = false;
+    std::string bundlePath;
+    bool lazy = false;
+    bool tiered = false;
+    uint64_t tierThreshold = 1000;
+    //The name of each option given, up to any '='.
+    std::vector<std::string> given;
+};
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (!arg.empty() && arg[0] == '-') {
+            options.given.push_back(arg.substr(0, arg.find('=')));
+        }
+        if (arg == "-O0") {
+            options.optimize = false;
+        } else if (arg == "--opt-report") {
+            options.optReport = true;
+        } else if (arg == "--loop-stats") {
+            options.loopStats = true;
+        } else if (arg == "--alloc-report") {
+            options.allocReport = true;
+        } else if (arg == "--dump-ir") {
+            options.dumpIR = true;
+        } else if (arg == "--lazy") {
+            options.lazy = true;
+        } else if (arg == "--tiered") {
+            options.tiered = true;
+        } else if (arg == "--bundle") {
+#ifndef KLANG_BUNDLE
+            throw std::runtime_error("Bundles are not supported on this platform");
+#endif
+            options.bundle = true;
+        } else if (arg == "-o") {
+            if (i + 1 == argc) {
+                throw std::runtime_error("-o needs a file name");
+            }
+            options.bundlePath = argv[++i];
+        } else if (arg.rfind("--engine=", 0) == 0) {
+            options.engine = arg.substr(9);
+            if (options.engine != "ast" && options.engine != "ir") {
+                throw std::runtime_error("Unknown engine: " + options.engine + " (expected ast or ir)");
+            }
+        } else if (arg.rfind("--output=", 0) == 0) {
+            std::string mode = arg.substr(9);
+            if (mode != "sync" && mode != "async") {
+                throw std::runtime_error("Unknown output mode: " + mode + " (expected sync or async)");
+            }
+#ifndef KLANG_ASYNC_OUTPUT
+            if (mode == "async") {
+                throw std::runtime_error("Asynchronous output is not supported on this platform");
+            }
+#endif
+            options.asyncOutput = mode == "async";
+        } else if (arg.rfind("--output-format=", 0) == 0) {
+            options.outputFormat = arg.substr(16);
+            if (options.outputFormat != "text" && options.outputFormat != "binary" && options.outputFormat != "ndjson") {
+                throw std::runtime_error("Unknown output format: " + options.outputFormat + " (expected text, binary or ndjson)");
+            }
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            options.tracePath = arg.substr(8);
+            if (options.tracePath.empty()) {
+                throw std::runtime_error("Missing trace file path");
+            }
+        } else if (arg.rfind("--bench=", 0) == 0) {
+            options.benchDir = arg.substr(8);
+            if (options.benchDir.empty()) {
+                throw std::runtime_error("Missing benchmark directory");
+            }
+        } else if (arg.rfind("--baseline=", 0) == 0) {
+            options.baselinePath = arg.substr(11);
+        } else if (arg.rfind("--save-baseline=", 0) == 0) {
+            options.saveBaselinePath = arg.substr(16);
+        } else if (arg.rfind("--bench-runs=", 0) == 0) {
+            try {
+                options.benchRuns = std::stoi(arg.substr(13));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid number of benchmark runs: " + arg.substr(13));
+            }
+            if (options.benchRuns < 5 || options.benchRuns > 1000) {
+                throw std::runtime_error("Number of benchmark runs must be between 5 and 1000");
+            }
+        } else if (arg.rfind("--bench-threshold=", 0) == 0) {
+            try {
+                options.benchThreshold = std::stod(arg.substr(18));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid benchmark threshold: " + arg.substr(18));
+            }
+            if (options.benchThreshold < 0) {
+                throw std::runtime_error("Benchmark threshold can't be negative");
+            }
+        } else if (arg.rfind("--inputs=", 0) == 0) {
+            options.inputsPath = arg.substr(9);
+            if (options.inputsPath.empty()) {
+                throw std::runtime_error("Missing inputs file path");
+            }
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            int threads;
+            try {
+                threads = std::stoi(arg.substr(10));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid number of threads: " + arg.substr(10));
+            }
+            if (threads < 1 || threads > 1024) {
+                throw std::runtime_error("Number of threads must be between 1 and 1024");
+            }
+            options.threads = threads;
+        } else if (arg.rfind("--max-steps=", 0) == 0 || arg.rfind("--max-output=", 0) == 0 || arg.rfind("--slice=", 0) == 0 ||
+                   arg.rfind("--tier-threshold=", 0) == 0) {
+            size_t equals = arg.find('=');
+            uint64_t limit;
+            try {
+                if (arg[equals + 1] == '-') throw std::invalid_argument(arg);
+                limit = std::stoull(arg.substr(equals + 1));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid limit: " + arg.substr(equals + 1));
+            }
+            if (arg.rfind("--max-steps=", 0) == 0) {
+                options.maxSteps = limit;
+            } else if (arg.rfind("--slice=", 0) == 0) {
+                if (limit < 1) throw std::runtime_error("Slice must be at least 1 step");
+                options.slice = limit;
+            } else if (arg.rfind("--tier-threshold=", 0) == 0) {
+                if (limit < 1) throw std::runtime_error("Tier threshold must be at least 1 iteration");
+                options.tierThreshold = limit;
+            } else {
+                options.maxOutput = limit;
+            }
+        } else if (arg.rfind("--stack-size=", 0) == 0) {
+#ifndef KLANG_STACK_THREAD
+            throw std::runtime_error("Setting the stack size is not supported on this platform");
+#endif
+            long long megabytes;
+            try {
+                megabytes = std::stoll(arg.substr(13));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid stack size: " + arg.substr(13));
+            }
+            if (megabytes < 1 || megabytes > (1 << 20)) {
+                throw std::runtime_error("Stack size must be between 1 and 1048576 MiB");
+            }
+            options.stackSize = size_t(megabytes) << 20;
+        } else if (arg.rfind("--unroll=", 0) == 0) {
+            try {
+                options.unroll = std::stoi(arg.substr(9));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Invalid unroll factor: " + arg.substr(9));
+            }
+            if (options.unroll < 1 || options.unroll > 16) {
+                throw std::runtime_error("Unroll factor must be between 1 and 16");
+            }
+        } else if (!arg.empty() && arg[0] == '-') {
+            throw std::runtime_error("Unknown option: " + arg);
+        } else {
+            options.file_path = arg;
+        }
+    }
+    if (options.loopStats && options.engine == "ir") {
+        throw std::runtime_error("--loop-stats needs the ast engine");
+    }
+    if (options.inputsPath.empty() && (options.threads || options.maxSteps != UINT64_MAX || options.maxOutput != SIZE_MAX ||
+                                       options.slice != Options().slice)) {
+        throw std::runtime_error("--threads, --slice, --max-steps and --max-output need --inputs");
+    }
+    if (!options.inputsPath.empty() && (!options.benchDir.empty() || options.optReport || options.dumpIR || options.loopStats ||
+                                        options.allocReport || !options.tracePath.empty())) {
+        throw std::runtime_error("--inputs only combines with -O0, --unroll, --output, --output-format, --threads, --slice and the limits");
+    }
+    if (options.bundle != !options.bundlePath.empty()) {
+        throw std::runtime_error("--bundle and -o need each other");
+    }
+    if (options.bundle && (options.file_path.empty() || options.optReport || options.dumpIR || options.loopStats || options.allocReport ||
+                           !options.tracePath.empty() || !options.benchDir.empty() || !options.inputsPath.empty() ||
+                           options.asyncOutput || options.outputFormat != "text")) {
+        throw std::runtime_error("--bundle needs a source file and only combines with -O0 and --unroll");
+    }
+    if (options.lazy && (options.engine == "ir" || options.dumpIR || !options.inputsPath.empty() || options.bundle || !options.benchDir.empty())) {
+        throw std::runtime_error("--lazy needs the ast engine and can't be combined with --dump-ir, --inputs, --bundle or --bench");
+    }
+    if (options.tierThreshold != Options().tierThreshold && !options.tiered) {
+        throw std::runtime_error("--tier-threshold needs --tiered");
+    }
+    if (options.tiered && (!options.optimize || options.engine == "ir" || options.dumpIR || !options.inputsPath.empty() || options.bundle ||
+                           !options.benchDir.empty())) {
+        throw std::runtime_error("--tiered needs the ast engine with optimization and can't be combined with --dump-ir, --inputs, --bundle or --bench");
+    }
+    if (options.benchDir.empty() && (!options.baselinePath.empty() || !options.saveBaselinePath.empty())) {
+        throw std::runtime_error("--baseline and --save-baseline need --bench");
+    }
+    if (!options.benchDir.empty() && (!options.file_path.empty() || options.optReport || options.dumpIR || options.loopStats ||
+                                      options.allocReport || !options.tracePath.empty())) {
+        throw std::runtime_error("--bench only combines with -O0, --engine and --unroll");
+    }
+    return options;
+}
+
+/*
+Parses the top-level statements with 'parse' and passes each to 'execute' in order. Statements are parsed one ahead so adjacent loops can
+be fused. An error parsing the lookahead is only reported after the statement before it has run, just as it would be without the
+lookahead.
+*/
+template <typename Parse, typename Execute>
+void for_each_statement(Parser& parser, Optimizer& optimizer, Parse parse, Execute execute) {
+    std::unique_ptr<AST> pending;
+    while (pending || parser.current_token_type() != EOF_TOKEN) {
+        if (!pending) {
+            pending = parse();
+        }
+        std::unique_ptr<AST> next;
+        std::exception_ptr parseError;
+        if (parser.current_token_type() != EOF_TOKEN) {
+            try {
+                next = parse();
+            } catch (const std::exception&) {
+                parseError = std::current_exception();
+            }
+        }
+        if (next && optimizer.fuse(pending, next)) {
+            continue;
+        }
+        execute(pending);
+        if (parseError) {
+            std::rethrow_exception(parseError);
+        }
+        pending = std::move(next);
+    }
+}
+
+/*
+Parses and runs a program one top-level statement at a time, optimizing each statement before it runs. The tracer is optional;
+errors are thrown once the statements before the failing one have run.
+*/
+void run_program(Parser& parser, Optimizer& optimizer, Interpreter& interpreter, IRInterpreter<>& irInterpreter, const Options& options,
+                 Output& output, Tracer* tracer) {
+    int statementNumber = 0;
+    //Holds the flattened form of the statement the IR engine runs, reused across statements.
+    IRCode::Writer flattened;
+
+    //Parses one top-level statement. The parse event's lexing_ns argument is the part of it spent in the lexer.
+    auto parse = [&]() {
+        AllocationTracker::Scope phase(AllocationTracker::Parse);
+        if (!tracer) return parser.statement();
+        auto start = Tracer::now();
+        auto lexing = parser.lexing_time();
+        auto node = parser.statement();
+        int64_t lexingNs = std::chrono::duration_cast<std::chrono::nanoseconds>(parser.lexing_time() - lexing).count();
+        tracer->record("parse", "parse", start, Tracer::now(), {{"line", node->line}, {"lexing_ns", lexingNs}});
+        return node;
+    };
+
+    auto execute = [&](std::unique_ptr<AST>& ast) {
+        Tracer::Clock::time_point start;
+        if (tracer) start = Tracer::now();
+        AllocationTracker::Scope phase(AllocationTracker::Optimize);
+        optimizer.optimize(ast);
+        statementNumber++;
+        if (tracer) {
+            tracer->record("optimize", "optimize", start, Tracer::now(), {{"statement", statementNumber}, {"line", ast->line}});
+            start = Tracer::now();
+        }
+        //Covers the whole statement, including loop events nested inside it and the time spent raising an error.
+        struct StatementEvent {
+            Tracer* tracer;
+            Tracer::Clock::time_point start;
+            int statement;
+            int line;
+            ~StatementEvent() {
+                if (tracer) tracer->record("statement", "execute", start, Tracer::now(), {{"statement", statement}, {"line", line}});
+            }
+        } event{tracer, start, statementNumber, ast->line};
+
+        if (options.engine == "ir" || options.dumpIR) {
+            IRFunction fn = optimizer.lower(ast);
+            if (options.dumpIR) {
+                output.flush();
+                std::cerr << "; statement " << statementNumber << "\n";
+                print_ir(fn, std::cerr);
+            }
+            if (options.engine == "ir") {
+                flattened.clear();
+                flattened.add(fn);
+                AllocationTracker::Scope running(AllocationTracker::Execute);
+                irInterpreter.run(flattened.view());
+                return;
+            }
+        }
+        AllocationTracker::Scope running(AllocationTracker::Execute);
+        ast->accept(interpreter);
+    };
+
+    for_each_statement(parser, optimizer, parse, execute);
+}
+
+//Makes the Output that --output asks for.
+std::unique_ptr<Output> make_output(const Options& options) {
+#ifdef KLANG_ASYNC_OUTPUT
+    if (options.asyncOutput) {
+        return std::make_unique<AsyncOutput>();
+    }
+#endif
+    return std::make_unique<StreamOutput>();
+}
+
+//Makes the printer for an --output-format.
+std::unique_ptr<Printer> make_printer(const std::string& format, Output& output) {
+    if (format == "binary") return std::make_unique<BinaryPrinter>(output);
+    if (format == "ndjson") return std::make_unique<JsonPrinter>(output);
+    return std::make_unique<TextPrinter>(output);
+}
+
+//The variables of a compiled Program by slot, with the slot interface of SymbolTable that IRInterpreter uses.
+class SlotVariables {
+private:
+    std::vector<int> values;
+    std::vector<bool> isDefined;
+
+public:
+    explicit SlotVariables(size_t count) : values(count), isDefined(count) {}
+
+    bool defined(size_t slot) const {
+        return isDefined[slot];
+    }
+
+    int value(size_t slot) const {
+        return values[slot];
+    }
+
+    void set(size_t slot, int value) {
+        isDefined[slot] = true;
+        values[slot] = value;
+    }
+};
+
+/*
+A program compiled once to be run many times: every statement is parsed, optimized and lowered to IR up front, the variables are
+interned into slots that the IR refers to directly, and the whole is flattened into one IRCode image. A loaded Program runs that image in
+place, from wherever it was mapped. A Program doesn't change once compile() or load() returns, so any number of Isolates can run the
+same one on different threads at the same time.
+*/
+class Program {
+private:
+    //Keeps the image alive: a buffer for a compiled program, or the mapping a program was loaded from.
+    std::shared_ptr<const void> storage;
+    const char* image = nullptr;
+    size_t imageSize = 0;
+    IRCode ir;
+    //The slot of each variable, by a name that points into the image.
+    std::unordered_map<std::string_view, size_t> slots;
+
+    Program(std::shared_ptr<const void> storage_, const char* image_, size_t imageSize_)
+        : storage(std::move(storage_)), image(image_), imageSize(imageSize_), ir(IRCode::view(image_, imageSize_)) {
+        for (size_t slot = 0; slot < ir.counts.names; slot++) {
+            slots.emplace(ir.text(ir.names[slot]), slot);
+        }
+    }
+
+public:
+    static std::shared_ptr<const Program> compile(const std::string& text, bool optimize, int unroll) {
+        SymbolTable symbolTable;
+        Optimizer optimizer(symbolTable, optimize, unroll);
+        IRCode::Writer writer;
+        try {
+            Lexer lexer(text);
+            Parser parser(lexer, symbolTable);
+            for_each_statement(parser, optimizer, [&]() { return parser.statement(); }, [&](std::unique_ptr<AST>& ast) {
+                optimizer.optimize(ast);
+                writer.add(optimizer.lower(ast));
+            });
+        } catch (const std::exception& e) {
+            // An error that stopped parsing is raised once the statements before it have run, as it would be by run_program.
+            writer.set_error(e.what());
+        }
+        for (size_t slot = 0; slot < symbolTable.size(); slot++) {
+            writer.add_name(symbolTable.name(slot));
+        }
+        auto buffer = std::make_shared<std::string>();
+        writer.write(*buffer);
+        return std::shared_ptr<const Program>(new Program(buffer, buffer->data(), buffer->size()));
+    }
+
+    /*
+    Appends the program to 'out' in the form load() reads: its image, as the interpreter holds it in memory. Numbers are in the byte
+    order of the machine, so only the build of the interpreter that saved a program can load it.
+    */
+    void save(std::string& out) const {
+        out.append(image, imageSize);
+    }
+
+    /*
+    Uses a program that save() wrote, at 'data', without copying it or lexing, parsing or optimizing anything. 'data' must be 4-byte
+    aligned, and 'storage' keeps it alive for as long as the Program is.
+    */
+    static std::shared_ptr<const Program> load(std::shared_ptr<const void> storage, const char* data, size_t size) {
+        return std::shared_ptr<const Program>(new Program(std::move(storage), data, size));
+    }
+
+    const IRCode& code() const {
+        return ir;
+    }
+
+    size_t statement_count() const {
+        return ir.counts.functions;
+    }
+
+    size_t slot_count() const {
+        return ir.counts.names;
+    }
+
+    std::optional<size_t> slot(const std::string& name) const {
+        auto it = slots.find(name);
+        if (it == slots.end()) return std::nullopt;
+        return it->second;
+    }
+
+    std::string_view parse_error() const {
+        return ir.text(ir.counts.error);
+    }
+};
+
+//What one Isolate may use. Running past a limit fails with an error, like any other runtime error.
+struct IsolateLimits {
+    //Basic blocks of IR executed, which bounds the time a run takes.
+    uint64_t maxSteps = UINT64_MAX;
+    size_t maxOutput = SIZE_MAX;
+};
+
+/*
+One run of a shared Program: the values of its variables, its output and its limits, and nothing else. Making an Isolate allocates its
+slot array and never parses or optimizes the program again, so thousands can run the same Program at once. A run can be split into
+slices: between them the Isolate holds the statement it is in and the IR frame of that statement, and any thread may resume it.
+*/
+class Isolate {
+private:
+    //Keeps the output in memory, failing once it would grow past the limit.
+    class Buffer : public Output {
+    private:
+        std::string data;
+        size_t limit;
+
+    public:
+        using Output::write;
+
+        explicit Buffer(size_t limit_) : limit(limit_) {}
+
+        void write(const char* bytes, size_t size) override {
+            if (size > limit - data.size()) {
+                throw std::runtime_error("Output limit exceeded");
+            }
+            data.append(bytes, size);
+        }
+
+        void commit() override {}
+        void flush() override {}
+
+        const std::string& contents() const {
+            return data;
+        }
+    };
+
+    std::shared_ptr<const Program> program;
+    SlotVariables variables;
+    Buffer buffer;
+    std::unique_ptr<Printer> printer;
+    IRInterpreter<SlotVariables> interpreter;
+    //The statement the run is in, and where in it the run stopped.
+    size_t statement = 0;
+    IRInterpreter<SlotVariables>::Frame frame;
+
+public:
+    Isolate(std::shared_ptr<const Program> program_, const std::string& outputFormat, IsolateLimits limits)
+        : program(std::move(program_)), variables(program->slot_count()), buffer(limits.maxOutput),
+          printer(make_printer(outputFormat, buffer)), interpreter(variables, *printer) {
+        interpreter.limit_steps(limits.maxSteps);
+    }
+
+    //Gives a variable a value before the run, as an input. The program is optimized without knowing it, so it is only read where the
+    //program might read it before assigning it. A name the program never uses is ignored.
+    void set(const std::string& name, int value) {
+        if (auto slot = program->slot(name)) {
+            variables.set(*slot, value);
+        }
+    }
+
+    //Runs the program to the end, throwing the first error it reports. The output written before an error is kept.
+    void run() {
+        resume(UINT64_MAX);
+    }
+
+    //Continues the run for about 'slice' steps: it stops at the first loop back-edge after that. Returns true once the program has
+    //finished. Throws the first error the program reports, after which the run can't be resumed.
+    bool resume(uint64_t slice) {
+        interpreter.yield_after(slice);
+        for (; statement < program->statement_count(); statement++) {
+            if (!interpreter.run(program->code(), statement, frame)) return false;
+        }
+        if (!program->parse_error().empty()) {
+            throw std::runtime_error(std::string(program->parse_error()));
+        }
+        return true;
+    }
+
+    const std::string& output() const {
+        return buffer.contents();
+    }
+};
+
+/*
+Runs tasks 0 to count - 1, which can be run a slice at a time, on 'threadCount' threads counting the calling one. Each thread has a queue:
+it takes the task at the front, runs one slice of it and puts it back at the end unless it has finished, so the tasks in a queue take
+turns. A thread whose queue is empty steals the task at the back of another's, so no thread idles while tasks wait elsewhere. When no
+task waits anywhere, it sleeps until one is put back or the last one finishes. 'slice(task)' returns true once the task has finished and must not throw.
+*/
+template <typename Slice>
+void schedule(size_t count, unsigned threadCount, Slice slice) {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+    threadCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadCount, count)));
+    std::vector<Queue> queues(threadCount);
+    for (size_t task = 0; task < count; task++) {
+        queues[task % threadCount].tasks.push_back(task);
+    }
+    std::atomic<size_t> unfinished{count};
+    //Bumped whenever a task is put back and when the last one finishes, to wake the threads that found nothing to take.
+    std::atomic<uint32_t> changes{0};
+
+    auto take = [&](size_t self) -> std::optional<size_t> {
+        for (size_t k = 0; k < queues.size(); k++) {
+            Queue& queue = queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            size_t task;
+            if (k == 0) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            } else {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return task;
+        }
+        return std::nullopt;
+    };
+    auto work = [&](size_t self) {
+        while (unfinished > 0) {
+            uint32_t seen = changes.load(std::memory_order_acquire);
+            std::optional<size_t> task = take(self);
+            if (!task) {
+                // Every unfinished task is in the middle of a slice on another thread. A change since 'seen' means one may be waiting.
+                changes.wait(seen, std::memory_order_acquire);
+                continue;
+            }
+            if (slice(*task)) {
+                if (--unfinished == 0) {
+                    changes.fetch_add(1, std::memory_order_release);
+                    changes.notify_all();
+                }
+            } else {
+                {
+                    std::lock_guard<std::mutex> lock(queues[self].mutex);
+                    queues[self].tasks.push_back(*task);
+                }
+                changes.fetch_add(1, std::memory_order_release);
+                changes.notify_one();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned k = 1; k < threadCount; k++) {
+        threads.emplace_back(work, k);
+    }
+    work(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+/*
+Runs --inputs: compiles the program once, then runs it in one Isolate per line of the inputs file, with the isolates taking turns a
+slice at a time on a pool of threads. A line holds 'name=value' inputs separated by spaces. The outputs are written in the order of the
+lines, each followed by the error that ended its run, if any. A line with an invalid input doesn't run, and reports that as its error.
+Returns the exit status.
+*/
+int run_isolates(const Options& options, const std::shared_ptr<const Program>& program, Output& output) {
+    std::ifstream file(options.inputsPath);
+    if (!file.is_open()) {
+        throw std::runtime_error("could not open file at " + options.inputsPath);
+    }
+    std::vector<std::vector<std::pair<std::string, int>>> inputs;
+    //The error of each line with an invalid input, empty for the others.
+    std::vector<std::string> invalid;
+    std::string line;
+    while (std::getline(file, line)) {
+        inputs.emplace_back();
+        invalid.emplace_back();
+        size_t pos = 0;
+        while ((pos = line.find_first_not_of(" \t\r", pos)) != std::string::npos) {
+            size_t end = line.find_first_of(" \t\r", pos);
+            std::string input = line.substr(pos, end - pos);
+            pos = end;
+            size_t equals = input.find('=');
+            bool valid = equals != std::string::npos && equals > 0 && std::isalpha(static_cast<unsigned char>(input[0]));
+            for (size_t k = 1; valid && k < equals; k++) {
+                valid = std::isalnum(static_cast<unsigned char>(input[k])) || input[k] == '_';
+            }
+            int value = 0;
+            if (valid) {
+                auto [parsed, error] = std::from_chars(input.data() + equals + 1, input.data() + input.size(), value);
+                valid = error == std::errc() && parsed == input.data() + input.size() && equals + 1 < input.size();
+            }
+            if (!valid) {
+                invalid.back() = "Invalid input: " + input;
+                break;
+            }
+            inputs.back().emplace_back(input.substr(0, equals), value);
+        }
+    }
+
+    IsolateLimits limits{options.maxSteps, options.maxOutput};
+
+    struct Result {
+        std::string output;
+        std::string error;
+    };
+    std::vector<Result> results(inputs.size());
+    std::vector<std::unique_ptr<Isolate>> isolates(inputs.size());
+    auto slice = [&](size_t k) {
+        if (!invalid[k].empty()) {
+            results[k].error = invalid[k];
+            return true;
+        }
+        if (!isolates[k]) {
+            isolates[k] = std::make_unique<Isolate>(program, options.outputFormat, limits);
+            for (const auto& [name, value] : inputs[k]) {
+                isolates[k]->set(name, value);
+            }
+        }
+        bool finished = true;
+        try {
+            finished = isolates[k]->resume(options.slice);
+        } catch (const std::exception& e) {
+            results[k].error = e.what();
+        }
+        if (finished) {
+            results[k].output = isolates[k]->output();
+            isolates[k].reset();
+        }
+        return finished;
+    };
+    schedule(inputs.size(), options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency()), slice);
+
+    int status = 0;
+    for (size_t k = 0; k < results.size(); k++) {
+        output.write(results[k].output.data(), results[k].output.size());
+        output.commit();
+        if (!results[k].error.empty()) {
+            output.flush();
+            std::cerr << "Error: line " << k + 1 << " of " << options.inputsPath << ": " << results[k].error << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
+
+#ifdef KLANG_BUNDLE
+/*
+A bundle is a copy of the interpreter's executable with a saved Program appended to it, then a trailer: where the Program starts, as a
+uint64, and the eight bytes of bundleMagic. The Program starts at a multiple of 8 bytes, padded with zeros, so it can run in place
+where the file is mapped. When a bundled executable starts, it finds the trailer at its own end and runs the Program in place of a
+source file, so the Lexer, Parser and Optimizer never run.
+*/
+constexpr char bundleMagic[8] = {'K', 'L', 'A', 'N', 'G', 'B', 'D', 'L'};
+constexpr size_t bundleTrailerSize = sizeof(uint64_t) + sizeof(bundleMagic);
+
+/*
+Tells a bundled executable apart without reading its file. write_bundle finds these bytes in its copy of the executable and sets the
+last one to '1', so only a bundle looks for the trailer. They are volatile so that they stay in the executable's data, where
+write_bundle finds them, and are read from there at run time.
+*/
+volatile char bundleMark[16] = {'K', 'L', 'A', 'N', 'G', ' ', 'B', 'U', 'N', 'D', 'L', 'E', 'D', ' ', '?', '0'};
+
+bool is_bundle() {
+    return bundleMark[sizeof(bundleMark) - 1] == '1';
+}
+
+//Where the saved Program starts in a file of 'fileSize' bytes that ends with 'trailer', or nullopt if the file isn't a bundle.
+std::optional<uint64_t> bundle_offset(const char* trailer, uint64_t fileSize) {
+    if (std::memcmp(trailer + sizeof(uint64_t), bundleMagic, sizeof(bundleMagic)) != 0) {
+        return std::nullopt;
+    }
+    uint64_t offset;
+    std::memcpy(&offset, trailer, sizeof(offset));
+    if (offset > fileSize - bundleTrailerSize || offset % 8 != 0) {
+        throw std::runtime_error("Corrupt bundle: bad trailer");
+    }
+    return offset;
+}
+
+//Runs --bundle: compiles the source file and writes it to the -o file, appended to a copy of this executable.
+int write_bundle(const Options& options) {
+    std::ifstream file(options.file_path);
+    if (!file.is_open()) {
+        throw std::runtime_error("could not open file at " + options.file_path);
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::shared_ptr<const Program> program = Program::compile(text, options.optimize, options.unroll);
+    // A program that can't be parsed is rejected now rather than when it is deployed.
+    if (!program->parse_error().empty()) {
+        throw std::runtime_error(std::string(program->parse_error()));
+    }
+
+    std::ifstream self("/proc/self/exe", std::ios::binary);
+    std::string image((std::istreambuf_iterator<char>(self)), std::istreambuf_iterator<char>());
+    if (!self.is_open() || image.size() < bundleTrailerSize) {
+        throw std::runtime_error("could not read the interpreter's executable");
+    }
+    // A bundled executable bundles a copy of the interpreter without its own program.
+    if (is_bundle()) {
+        if (auto offset = bundle_offset(image.data() + image.size() - bundleTrailerSize, image.size())) {
+            image.resize(*offset);
+        }
+    }
+    char mark[sizeof(bundleMark)];
+    for (size_t k = 0; k < sizeof(mark); k++) {
+        mark[k] = bundleMark[k];
     }
+    size_t at = image.find(std::string_view(mark, sizeof(mark) - 1));
+    if (at == std::string::npos || image.find(std::string_view(mark, sizeof(mark) - 1), at + 1) != std::string::npos) {
+        throw std::runtime_error("could not find where to mark the interpreter's executable as a bundle");
+    }
+    image[at + sizeof(mark) - 1] = '1';
 
-    //Visits a LogicalOpNode, evaluates the left and right expressions, and stores the result of the logical operation in the lastValue variable.
-    void visit(LogicalOpNode* node) override {
-        node->left->accept(*this);
-        bool left = lastValue.value();
+    image.resize((image.size() + 7) / 8 * 8, '\0');
+    uint64_t programOffset = image.size();
+    program->save(image);
+    image.append(reinterpret_cast<const char*>(&programOffset), sizeof(programOffset));
+    image.append(bundleMagic, sizeof(bundleMagic));
 
-        if (node->op == AND && !left) {
-            lastValue = false;
-            return;
+    std::ofstream out(options.bundlePath, std::ios::binary | std::ios::trunc);
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    out.close();
+    if (!out) {
+        throw std::runtime_error("could not write " + options.bundlePath);
+    }
+    namespace fs = std::filesystem;
+    fs::permissions(options.bundlePath, fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec | fs::perms::others_read |
+                                            fs::perms::others_exec);
+    return 0;
+}
+
+/*
+Maps the Program bundled into the running executable and runs it from the mapping, which stays until the Program is gone. Only the pages
+holding the Program are mapped. Only called in a bundle.
+*/
+std::shared_ptr<const Program> embedded_program() {
+    int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("could not open the bundled executable");
+    }
+    struct stat info;
+    char trailer[bundleTrailerSize];
+    std::optional<uint64_t> offset;
+    try {
+        if (fstat(fd, &info) == 0 && static_cast<uint64_t>(info.st_size) >= bundleTrailerSize &&
+            pread(fd, trailer, bundleTrailerSize, info.st_size - static_cast<off_t>(bundleTrailerSize)) ==
+                static_cast<ssize_t>(bundleTrailerSize)) {
+            offset = bundle_offset(trailer, info.st_size);
         }
-        if (node->op == OR && left) {
-            lastValue = true;
-            return;
+        if (!offset) {
+            throw std::runtime_error("Corrupt bundle: no program at the end of the executable");
         }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
 
-        node->right->accept(*this);
-        bool right = lastValue.value();
-
-        lastValue = (node->op == AND) ? (left && right) : (left || right);
+    uint64_t pageStart = *offset & ~(static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) - 1);
+    size_t mappedSize = info.st_size - pageStart;
+    void* mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(pageStart));
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("could not map the bundled program");
     }
+    std::shared_ptr<const void> mapping(mapped, [mappedSize](const void* pages) { munmap(const_cast<void*>(pages), mappedSize); });
+    return Program::load(mapping, static_cast<const char*>(mapped) + (*offset - pageStart),
+                         mappedSize - (*offset - pageStart) - bundleTrailerSize);
+}
 
-    //Visits an IfNode, evaluates the condition
-    void visit(IfNode* node) override {
-        node->condition->accept(*this);
-        if (lastValue.value()) {
-            for (const auto& stmt : node->body) {
-                stmt->accept(*this);
-            }
+//Runs the Program bundled into this executable with the ir engine, once or, with --inputs, in isolates. Returns the exit status.
+int run_bundled(const Options& options, const std::shared_ptr<const Program>& program) {
+    static const std::set<std::string> accepted = {"--output", "--output-format", "--inputs", "--threads", "--slice", "--max-steps",
+                                                   "--max-output"};
+    for (const std::string& option : options.given) {
+        if (!accepted.count(option)) {
+            throw std::runtime_error("This executable runs its bundled program, so " + option + " doesn't apply. It only takes --output, "
+                                     "--output-format, --inputs, --threads, --slice and the limits");
         }
     }
-    //Visits a WhileNode, evaluates the condition
-    void visit(WhileNode* node) override {
-        while (true) {
-            node->condition->accept(*this);
-            if (!lastValue.value()) break;
-            
-            for (const auto& stmt : node->body) {
-                stmt->accept(*this);
+    if (!options.file_path.empty()) {
+        throw std::runtime_error("This executable runs its bundled program and doesn't take a source file");
+    }
+    std::unique_ptr<Output> output = make_output(options);
+    int status = 0;
+    try {
+        if (!options.inputsPath.empty()) {
+            status = run_isolates(options, program, *output);
+        } else {
+            SlotVariables variables(program->slot_count());
+            std::unique_ptr<Printer> printer = make_printer(options.outputFormat, *output);
+            IRInterpreter<SlotVariables> interpreter(variables, *printer);
+            interpreter.run(program->code());
+            if (!program->parse_error().empty()) {
+                throw std::runtime_error(std::string(program->parse_error()));
             }
         }
+    } catch (const std::exception& e) {
+        output->flush();
+        std::cerr << "Error: " << e.what() << std::endl;
+        status = 1;
     }
+    output->flush();
+    return status;
+}
+#endif
 
-    //Visits a ForNode, evaluates the start and end expressions, and iterates over the body of the for loop.
-    void visit(ForNode* node) override {
-        node->start->accept(*this);
-        int start = lastValue.value();
-        node->end->accept(*this);
-        int end = lastValue.value();
+//Just enough JSON to read a benchmark baseline back: objects, arrays, strings, numbers, true, false and null.
+struct JsonValue {
+    enum Kind { Null, Boolean, Number, String, Array, Object };
+    Kind kind = Null;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
 
-        for (int i = start; i <= end; i++) {
-            symbolTable.addOrUpdate(node->var_name, "INTEGER", std::to_string(i));
-            for (const auto& stmt : node->body) {
-                stmt->accept(*this);
-            }
+    const JsonValue* get(const std::string& key) const {
+        for (const auto& [name, value] : object) {
+            if (name == key) return &value;
         }
+        return nullptr;
     }
 };
 
-class Parser {
+class JsonReader {
 private:
-    Lexer lexer;
-    Token current_token;
-    SymbolTable& symbolTable;
+    const std::string& text;
+    size_t pos = 0;
 
-    //Consumes the current token if it matches the expected token_type. If not, it will throw a runtime error. 
-    void eat(TokenType token_type) {
-        if (current_token.type == token_type) {
-            current_token = lexer.get_next_token();
-        } else {
-            throw std::runtime_error("Unexpected token: " + current_token.value);
-        }
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error("Invalid JSON at offset " + std::to_string(pos) + ": " + message);
     }
 
-    /*
-    This method parses a factor, which can be an integer, variable, or an expression in parentheses and returns a unique pointer to the AST node that represents the factor. 
-    If the current token is an INTEGER, it consumes the token and returns a NumberNode. 
-    If the token is an identifier, it consumes it and returns a VariableNode. If the token is LPAREN, it consumes the token, parses the expression and expects a RPAREN to follow.
-    */
-    std::unique_ptr<AST> factor() {
-        Token token = current_token;
-        if (token.type == INTEGER) {
-            eat(INTEGER);
-            return std::make_unique<NumberNode>(std::stoi(token.value));
-        } else if (token.type == ID) {
-            eat(ID);
-            return std::make_unique<VariableNode>(token.value);
-        } else if (token.type == LPAREN) {
-            eat(LPAREN);
-            auto node = expr();
-            eat(RPAREN);
-            return node;
-        }
-        throw std::runtime_error("Syntax error in factor");
+    void skip_whitespace() {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) pos++;
     }
 
-    /*
-    This method parses a term, which is a factor followed by multiplication or division operations. 
-    While the current token is a multiplication or division operator, it consumes the operator and the next factor, creating a BinaryOpNode for each operation. 
-    It returns a unique pointer to the AST node that represents that term. 
-    */ 
-    std::unique_ptr<AST> term() {
-        auto node = factor();
-
-        while (current_token.type == MUL || current_token.type == DIV) {
-            Token token = current_token;
-            eat(token.type);
-            node = std::make_unique<BinaryOpNode>(token.type, std::move(node), factor());
+    void expect(char c) {
+        skip_whitespace();
+        if (pos >= text.size() || text[pos] != c) fail(std::string("expected '") + c + "'");
+        pos++;
+    }
+
+    bool consume(char c) {
+        skip_whitespace();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
         }
-        return node;
+        return false;
     }
 
-    /*
-    This method parses an expression, which is a term followed by addition or subtraction operations. 
-    While the current token is an addition or subtraction operator, it consumes the operator and the next term, creating a BinaryOpNode for each operation. 
-    It then returns a unique pointer to the AST node representing the expression. 
-    */
-    std::unique_ptr<AST> expr() {
-        auto node = term();
+    std::string string_literal() {
+        expect('"');
+        std::string result;
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c == '\\') {
+                if (pos >= text.size()) break;
+                c = text[pos++];
+                if (c == 'n') c = '\n';
+                else if (c == 't') c = '\t';
+                else if (c != '"' && c != '\\' && c != '/') fail("unsupported escape");
+            }
+            result += c;
+        }
+        if (pos >= text.size()) fail("unterminated string");
+        pos++;
+        return result;
+    }
 
-        while (current_token.type == PLUS || current_token.type == MINUS) {
-            Token token = current_token;
-            eat(token.type);
-            node = std::make_unique<BinaryOpNode>(token.type, std::move(node), term());
+    JsonValue value() {
+        skip_whitespace();
+        JsonValue result;
+        if (pos >= text.size()) fail("unexpected end");
+        char c = text[pos];
+        if (c == '{') {
+            pos++;
+            result.kind = JsonValue::Object;
+            if (consume('}')) return result;
+            do {
+                std::string key = string_literal();
+                expect(':');
+                result.object.emplace_back(key, value());
+            } while (consume(','));
+            expect('}');
+        } else if (c == '[') {
+            pos++;
+            result.kind = JsonValue::Array;
+            if (consume(']')) return result;
+            do {
+                result.array.push_back(value());
+            } while (consume(','));
+            expect(']');
+        } else if (c == '"') {
+            result.kind = JsonValue::String;
+            result.string = string_literal();
+        } else if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0) {
+            result.kind = JsonValue::Boolean;
+            result.number = c == 't';
+            pos += c == 't' ? 4 : 5;
+        } else if (text.compare(pos, 4, "null") == 0) {
+            pos += 4;
+        } else {
+            const char* start = text.c_str() + pos;
+            char* end = nullptr;
+            result.kind = JsonValue::Number;
+            result.number = std::strtod(start, &end);
+            if (end == start) fail("unexpected character");
+            pos += end - start;
         }
-        return node;
+        return result;
     }
 
-    /*
-    This method parses a simple condition, which is an expression followed by a comparison operator and another expression. 
-    It checks if the current token is a comparison operator. If it is, it consumes the operator and the next expression, creating a ComparisonNode. 
-    It returns a unique pointer to the AST node that represents the condition.
-    */
-    std::unique_ptr<AST> simple_condition() {
-        auto left = expr();
-        TokenType op = current_token.type;
-        
-        switch(op) {
-            case EQUAL_TO:
-            case NOT_EQUAL_TO:
-            case GREATER_THAN:
-            case LESS_THAN:
-            case GREATER_THAN_OR_EQUAL_TO:
-            case LESS_THAN_OR_EQUAL_TO:
-                eat(op);
-                return std::make_unique<ComparisonNode>(op, std::move(left), expr());
-            default:
-                throw std::runtime_error("Invalid comparison operator");
+public:
+    JsonReader(const std::string& text_) : text(text_) {}
+
+    JsonValue parse() {
+        JsonValue result = value();
+        skip_whitespace();
+        if (pos != text.size()) fail("trailing characters");
+        return result;
+    }
+};
+
+/*
+One-sided p-value for the samples in 'current' tending to be larger than those in 'baseline', from the normal approximation to the
+Mann-Whitney U distribution with a correction for ties and for continuity. It makes no assumption about the shape of the timing
+distribution, so a few outliers from the rest of the machine don't decide the result the way they would move a mean.
+*/
+double mann_whitney_p(const std::vector<int64_t>& baseline, const std::vector<int64_t>& current) {
+    std::vector<std::pair<int64_t, bool>> combined;
+    for (int64_t sample : baseline) combined.emplace_back(sample, false);
+    for (int64_t sample : current) combined.emplace_back(sample, true);
+    std::sort(combined.begin(), combined.end());
+
+    double n1 = current.size();
+    double n2 = baseline.size();
+    double n = n1 + n2;
+    double rankSum = 0;
+    double ties = 0;
+    for (size_t k = 0; k < combined.size();) {
+        size_t end = k;
+        while (end < combined.size() && combined[end].first == combined[k].first) end++;
+        //Tied samples share the average of the ranks they span.
+        double rank = (k + 1 + end) / 2.0;
+        double count = end - k;
+        ties += count * count * count - count;
+        for (; k < end; k++) {
+            if (combined[k].second) rankSum += rank;
         }
     }
+    double u = rankSum - n1 * (n1 + 1) / 2;
+    double variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+    if (variance <= 0) return 1;
+    double z = (u - n1 * n2 / 2 - 0.5) / std::sqrt(variance);
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
 
-    /*
-    This method parses a condition in an abstract syntax tree (AST), which can be a simple condition potentially followed by logical AND or OR operations. 
-    It starts by parsing a simple condition and assigns it to the node variable. 
-    Then, while the current token represents a logical AND or OR operator, the method consumes the operator, 
-    creates a new logical operation node LogicalOpNode using std::make_unique, and updates the node by linking it to the newly parsed condition.
-    Finally, it returns a unique pointer to the resulting AST node.
-    */
-    std::unique_ptr<AST> condition() {
-        auto node = simple_condition();
+/*
+Runs the --bench suite: every .txt program in a directory, in three phases. 'lex' turns the whole source into tokens, 'parse' parses
+it without running it, and 'run' parses, optimizes and executes it the way main does with its output discarded. Each phase is run a
+few times to warm up and then timed 'runs' times while pinned to one CPU. The samples can be saved as a JSON baseline, and a later
+suite compared against one: a phase regressed when its median is more than the threshold slower than the baseline's and the
+Mann-Whitney test gives a p-value below 'significance'.
+*/
+class Benchmark {
+private:
+    static constexpr int warmupRuns = 3;
+    static constexpr double significance = 0.01;
+    static constexpr int64_t minSampleNs = 1000000;
+    static constexpr const char* phases[] = {"lex", "parse", "run"};
 
-        while (current_token.type == AND || current_token.type == OR) {
-            Token token = current_token;
-            eat(token.type);
-            node = std::make_unique<LogicalOpNode>(token.type, std::move(node), simple_condition());
+    struct Result {
+        std::string workload;
+        std::string phase;
+        size_t bytes;
+        std::vector<int64_t> samples;
+    };
+
+    const Options& options;
+    std::vector<Result> results;
+
+    //The settings that change what 'run' measures. A baseline is only comparable with a suite run under the same ones.
+    std::string config() const {
+        return "engine=" + options.engine + " optimize=" + (options.optimize ? "on" : "off") + " unroll=" + std::to_string(options.unroll);
+    }
+
+    static std::string read_file(const std::string& path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            throw std::runtime_error("could not open file at " + path);
         }
-        return node;
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
     }
 
-    /*
-     This method parses an if statement by first consuming the IF token and parsing the associated condition. 
-     After consuming the THEN token, it processes the body of the if statement by repeatedly parsing individual statements and adding them to a vector until the END token is encountered. 
-     Finally, it consumes the END token and returns a unique pointer to an IfNode representing the entire if statement, comprising the condition and the body.
-    */
-    std::unique_ptr<AST> if_statement() {
-        eat(IF);
-        auto cond = condition();
-        eat(THEN);
-        
-        std::vector<std::unique_ptr<AST>> body;
-        while (current_token.type != END) {
-            body.push_back(statement());
+    static int64_t median(std::vector<int64_t> samples) {
+        std::sort(samples.begin(), samples.end());
+        size_t middle = samples.size() / 2;
+        return samples.size() % 2 ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2;
+    }
+
+    static bool pin_to_current_cpu(int& cpu) {
+#ifdef KLANG_PIN_CPU
+        cpu = sched_getcpu();
+        if (cpu < 0) return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+        cpu = -1;
+        return false;
+#endif
+    }
+
+    void run_phase(const std::string& phase, const std::string& text) const {
+        SymbolTable symbolTable;
+        Lexer lexer(text);
+        if (phase == "lex") {
+            while (lexer.get_next_token().type != EOF_TOKEN) {}
+            return;
         }
-        eat(END);
-        
-        return std::make_unique<IfNode>(std::move(cond), std::move(body));
+        Parser parser(lexer, symbolTable);
+        if (phase == "parse") {
+            while (parser.current_token_type() != EOF_TOKEN) {
+                parser.statement();
+            }
+            return;
+        }
+        NullOutput output;
+        TextPrinter printer(output);
+        Optimizer optimizer(symbolTable, options.optimize, options.unroll);
+        Interpreter interpreter(symbolTable, printer);
+        IRInterpreter irInterpreter(symbolTable, printer);
+        run_program(parser, optimizer, interpreter, irInterpreter, options, output, nullptr);
     }
 
-    /*
-    This method parses a while statement by consuming the WHILE token and parsing the associated condition using the condition() method. 
-    It then consumes the THEN token and parses the body of the while loop by repeatedly processing statements and adding them to a vector until the END token is encountered. 
-    Finally, it consumes the END token and returns a unique pointer to a WhileNode representing the complete while statement, which includes the condition and the loop body.
-    */
-    std::unique_ptr<AST> while_statement() {
-        eat(WHILE);
-        auto cond = condition();
-        eat(THEN);
-        
-        std::vector<std::unique_ptr<AST>> body;
-        while (current_token.type != END) {
-            body.push_back(statement());
+    //Times 'iterations' back-to-back runs of a phase and returns the nanoseconds per run.
+    int64_t time_phase(const std::string& workload, const std::string& phase, const std::string& text, int64_t iterations) const {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            for (int64_t k = 0; k < iterations; k++) {
+                run_phase(phase, text);
+            }
+        } catch (const std::exception& e) {
+            throw std::runtime_error(workload + ": " + e.what());
         }
-        eat(END);
-        
-        return std::make_unique<WhileNode>(std::move(cond), std::move(body));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / iterations;
     }
 
     /*
-    This method parses a for statement by consuming the FOR token and retrieving the variable name from the current token. 
-    It then consumes the ASSIGN token, parses the start expression, and consumes the TO token to parse the end expression. 
-    Afterward, it processes the body of the for loop by parsing individual statements and adding them to a vector until the END token is encountered. 
-    Finally, it consumes the END token and returns a unique pointer to a ForNode representing the complete for statement, including the variable, start expression, end expression, and body.
+    Phases that finish within the clock's noise are repeated, so that every sample takes at least minSampleNs; the warmup runs find
+    how many repetitions that takes. The samples are then taken round-robin across all workloads, so that the machine slowing down
+    or speeding up partway through the suite affects every phase alike instead of the few that happened to run at the time.
     */
-    std::unique_ptr<AST> for_statement() {
-        eat(FOR);
-        std::string var_name = current_token.value;
-        eat(ID);
-        eat(ASSIGN);
-        auto start = expr();
-        eat(TO);
-        auto end = expr();
-        
-        std::vector<std::unique_ptr<AST>> body;
-        while (current_token.type != END) {
-            body.push_back(statement());
+    void measure(const std::vector<std::string>& workloads) {
+        std::vector<std::string> texts;
+        std::vector<int64_t> iterations;
+        for (const std::string& workload : workloads) {
+            texts.push_back(read_file((std::filesystem::path(options.benchDir) / workload).string()));
+            for (const char* phase : phases) {
+                int64_t count = 1;
+                for (int k = 0; k < warmupRuns; k++) {
+                    int64_t perRun = std::max<int64_t>(time_phase(workload, phase, texts.back(), count), 1);
+                    count = std::max<int64_t>(count, minSampleNs / perRun);
+                }
+                iterations.push_back(count);
+                results.push_back(Result{workload, phase, texts.back().size(), {}});
+            }
+        }
+        for (int k = 0; k < options.benchRuns; k++) {
+            for (size_t r = 0; r < results.size(); r++) {
+                Result& result = results[r];
+                result.samples.push_back(time_phase(result.workload, result.phase, texts[r / std::size(phases)], iterations[r]));
+            }
         }
-        eat(END);
-        
-        return std::make_unique<ForNode>(std::move(var_name), std::move(start), std::move(end), std::move(body));
     }
 
-    /*
-    This method parses a print statement by consuming the PRINT token and the left parenthesis, followed by parsing the first expression and adding it to a vector of expressions. 
-    While the current token is a comma, it consumes the comma and parses subsequent expressions, adding each to the vector. 
-    After all expressions are processed, it consumes the right parenthesis and returns a unique pointer to a PrintNode representing the print statement with the list of parsed expressions.
-    */
-    std::unique_ptr<AST> print_statement() {
-        eat(PRINT);
-        eat(LPAREN);
-        std::vector<std::unique_ptr<AST>> expressions;
-        
-        expressions.push_back(expr());
-        while (current_token.type == COMMA) {
-            eat(COMMA);
-            expressions.push_back(expr());
+    void save(const std::string& path) const {
+        std::ofstream file(path);
+        file << "{\n  \"config\": \"" << config() << "\",\n  \"runs\": " << options.benchRuns << ",\n  \"results\": [";
+        for (size_t k = 0; k < results.size(); k++) {
+            const Result& result = results[k];
+            file << (k ? ",\n" : "\n") << "    {\"workload\": \"" << result.workload << "\", \"phase\": \"" << result.phase
+                 << "\", \"bytes\": " << result.bytes << ", \"samples_ns\": [";
+            for (size_t s = 0; s < result.samples.size(); s++) {
+                file << (s ? ", " : "") << result.samples[s];
+            }
+            file << "]}";
+        }
+        file << "\n  ]\n}\n";
+        if (!file) {
+            throw std::runtime_error("could not write baseline to " + path);
         }
-        
-        eat(RPAREN);
-        return std::make_unique<PrintNode>(std::move(expressions));
     }
 
-    /*
-    This method parses an assignment statement in an abstract syntax tree (AST) by retrieving the variable name from the current token and then consuming the ID and ASSIGN tokens. 
-    It subsequently parses the assigned expression and returns a unique pointer to an AssignNode that represents the assignment statement, 
-    linking the variable name to the parsed expression.
-    */
-    std::unique_ptr<AST> assignment_statement() {
-        std::string var_name = current_token.value;
-        eat(ID);
-        eat(ASSIGN);
-        return std::make_unique<AssignNode>(var_name, expr());
+    //The baseline's samples, keyed by workload and phase.
+    std::map<std::pair<std::string, std::string>, std::vector<int64_t>> load(const std::string& path) const {
+        JsonValue root = JsonReader(read_file(path)).parse();
+        const JsonValue* baselineConfig = root.get("config");
+        const JsonValue* entries = root.get("results");
+        if (!baselineConfig || !entries || entries->kind != JsonValue::Array) {
+            throw std::runtime_error(path + " is not a benchmark baseline");
+        }
+        if (baselineConfig->string != config()) {
+            throw std::runtime_error("Baseline " + path + " was recorded with " + baselineConfig->string + ", not " + config());
+        }
+        std::map<std::pair<std::string, std::string>, std::vector<int64_t>> baseline;
+        for (const JsonValue& entry : entries->array) {
+            const JsonValue* workload = entry.get("workload");
+            const JsonValue* phase = entry.get("phase");
+            const JsonValue* samples = entry.get("samples_ns");
+            if (!workload || !phase || !samples || samples->kind != JsonValue::Array || samples->array.empty()) {
+                throw std::runtime_error(path + " has a malformed result");
+            }
+            auto& values = baseline[{workload->string, phase->string}];
+            for (const JsonValue& sample : samples->array) {
+                values.push_back(static_cast<int64_t>(sample.number));
+            }
+        }
+        return baseline;
     }
 
 public:
-    Parser(Lexer lexer_, SymbolTable& symbolTable_) 
-        : lexer(lexer_), current_token(lexer.get_next_token()), symbolTable(symbolTable_) {}
-    
-    TokenType current_token_type() const {
-        return current_token.type;
-    }
+    Benchmark(const Options& options_) : options(options_) {}
 
-    /*Parses a statement, which can be if, for, while, assign or print.*/
-    std::unique_ptr<AST> statement() {
-        switch (current_token.type) {
-            case IF:
-                return if_statement();
-            case FOR:
-                return for_statement();
-            case WHILE:
-                return while_statement();
-            case ID:
-                return assignment_statement();
-            case PRINT:
-                return print_statement();
-            default:
-                throw std::runtime_error("Invalid statement");
+    //Runs the suite and prints a table of the results to 'out'. Returns how many phases regressed against the baseline.
+    int run(std::ostream& out) {
+        if (!std::filesystem::is_directory(options.benchDir)) {
+            throw std::runtime_error("could not open benchmark directory " + options.benchDir);
         }
+        std::vector<std::string> workloads;
+        for (const auto& entry : std::filesystem::directory_iterator(options.benchDir)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".txt") {
+                workloads.push_back(entry.path().filename().string());
+            }
+        }
+        if (workloads.empty()) {
+            throw std::runtime_error("No .txt workloads in " + options.benchDir);
+        }
+        std::sort(workloads.begin(), workloads.end());
+
+        std::map<std::pair<std::string, std::string>, std::vector<int64_t>> baseline;
+        if (!options.baselinePath.empty()) {
+            baseline = load(options.baselinePath);
+        }
+
+        int cpu;
+        bool pinned = pin_to_current_cpu(cpu);
+        out << "benchmark: " << workloads.size() << " workloads, " << warmupRuns << " warmup + " << options.benchRuns << " runs, " << config();
+        out << (pinned ? ", pinned to cpu " + std::to_string(cpu) : std::string(", not pinned")) << "\n";
+
+        measure(workloads);
+        if (!options.saveBaselinePath.empty()) {
+            save(options.saveBaselinePath);
+        }
+
+        std::streamsize precision = out.precision(1);
+        out << std::fixed;
+        int regressions = 0;
+        for (const Result& result : results) {
+            double medianUs = median(result.samples) / 1e3;
+            out << result.workload << " " << result.phase << ": median " << medianUs << " us";
+            if (result.phase != "run") {
+                //Bytes of source per microsecond is MB/s.
+                out << " (" << result.bytes * 1e3 / median(result.samples) << " MB/s)";
+            }
+            auto base = baseline.find({result.workload, result.phase});
+            if (base != baseline.end()) {
+                double baseUs = median(base->second) / 1e3;
+                double change = (medianUs / baseUs - 1) * 100;
+                double p = mann_whitney_p(base->second, result.samples);
+                out << ", baseline " << baseUs << " us, " << (change >= 0 ? "+" : "") << change << "%, p=";
+                out.precision(4);
+                out << p;
+                out.precision(1);
+                if (change > options.benchThreshold && p < significance) {
+                    out << "  REGRESSION";
+                    regressions++;
+                }
+            } else if (!baseline.empty()) {
+                out << ", not in baseline";
+            }
+            out << "\n";
+        }
+        out.unsetf(std::ios::floatfield);
+        out.precision(precision);
+        return regressions;
     }
 };
 
-int main() {
+/*
+Calls 'work' on a thread with a stack of 'stackSize' bytes and returns what it returns. The optimization passes and the interpreter
+recurse through a few frames for every level of nesting in the program, so the stack size bounds how deeply a program can nest. Only
+the pages of the stack that are touched take up memory.
+*/
+template <typename Work>
+int run_with_stack(size_t stackSize, Work work) {
+#ifdef KLANG_STACK_THREAD
+    struct Call {
+        Work& work;
+        int result = 0;
+        std::exception_ptr error;
+
+        static void* start(void* argument) {
+            Call& call = *static_cast<Call*>(argument);
+            try {
+                call.result = call.work();
+            } catch (...) {
+                call.error = std::current_exception();
+            }
+            return nullptr;
+        }
+    } call{work, 0, nullptr};
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_t thread;
+    int error = pthread_attr_setstacksize(&attributes, stackSize);
+    if (error == 0) {
+        error = pthread_create(&thread, &attributes, &Call::start, &call);
+    }
+    pthread_attr_destroy(&attributes);
+    if (error != 0) {
+        throw std::runtime_error("could not start a thread with a " + std::to_string(stackSize >> 20) + " MiB stack");
+    }
+    pthread_join(thread, nullptr);
+    if (call.error) {
+        std::rethrow_exception(call.error);
+    }
+    return call.result;
+#else
+    (void)stackSize;
+    return work();
+#endif
+}
+
+//Runs the program or the benchmark suite that the options ask for and returns the exit status.
+int interpret(const Options& options) {
+    if (!options.benchDir.empty()) {
+        try {
+            int regressions = Benchmark(options).run(std::cout);
+            std::cout.flush();
+            if (regressions) {
+                std::cerr << "Error: " << regressions << " significant regressions against " << options.baselinePath << std::endl;
+                return 1;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
     // Once the interpreter code is run, type ./filename.txt in the terminal to run the code in the external file. This interface is intended to mimic a simple command line. 
-    std::string file_path;
-    std::cin >> file_path;
+    // The file can also be given as a command line argument, which skips the prompt.
+    std::string file_path = options.file_path;
+    if (file_path.empty()) {
+        std::cin >> file_path;
+    }
+
+    std::unique_ptr<Tracer> tracer;
+    if (!options.tracePath.empty()) {
+        tracer = std::make_unique<Tracer>();
+    }
+    auto readStart = Tracer::now();
 
     std::ifstream file(file_path);
     if (!file.is_open()) {
@@ -778,21 +7520,119 @@ int main() {
 
     std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
     file.close();
+    if (tracer) {
+        tracer->record("read source", "phase", readStart, Tracer::now(), {{"bytes", static_cast<int64_t>(text.size())}});
+    }
+
+    std::unique_ptr<Output> output = make_output(options);
+    std::unique_ptr<Printer> printer = make_printer(options.outputFormat, *output);
+
+    if (!options.inputsPath.empty()) {
+        int status;
+        try {
+            status = run_isolates(options, Program::compile(text, options.optimize, options.unroll), *output);
+        } catch (const std::exception& e) {
+            output->flush();
+            std::cerr << "Error: " << e.what() << std::endl;
+            status = 1;
+        }
+        output->flush();
+        return status;
+    }
 
+    SymbolTable symbolTable;
+    Optimizer optimizer(symbolTable, options.optimize, options.unroll);
+    LoopCompiler loopCompiler(optimizer, options.tierThreshold);
+    if (options.tiered) {
+        optimizer.defer_to_tiers();
+    }
+    LoopStats loopStats;
+    int status = 0;
     try {
         Lexer lexer(text);
-        SymbolTable symbolTable;
         Parser parser(lexer, symbolTable);
-        Interpreter interpreter(symbolTable);
+        if (options.lazy) {
+            parser.parse_lazily(symbolTable, [&optimizer](std::unique_ptr<AST>& ast) { optimizer.optimize_body(ast); });
+        }
+        Interpreter interpreter(symbolTable, *printer);
+        IRInterpreter irInterpreter(symbolTable, *printer);
+        if (tracer) {
+            parser.time_lexing();
+            interpreter.trace(tracer.get());
+        }
+        if (options.loopStats) {
+            interpreter.profile_loops(&loopStats);
+        }
+        if (options.tiered) {
+            interpreter.tier(&loopCompiler);
+        }
+        run_program(parser, optimizer, interpreter, irInterpreter, options, *output, tracer.get());
+    } catch (const std::exception& e) {
+        output->flush();
+        std::cerr << "Error: " << e.what() << std::endl;
+        status = 1;
+    }
+    output->flush();
+
+    if (options.optReport) {
+        optimizer.statistics().print(std::cerr);
+    }
+    if (options.loopStats) {
+        loopStats.print(std::cerr);
+    }
+    if (options.allocReport) {
+        AllocationTracker::print(std::cerr);
+    }
+    if (tracer) {
+        std::ofstream traceFile(options.tracePath);
+        tracer->write(traceFile);
+        if (!traceFile) {
+            std::cerr << "Error: could not write trace to " << options.tracePath << std::endl;
+            return 1;
+        }
+    }
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    AllocationTracker::enabled = options.allocReport;
 
-        while (parser.current_token_type() != EOF_TOKEN) {
-            auto ast = parser.statement();
-            ast->accept(interpreter);
+#ifdef KLANG_BUNDLE
+    //A bundled executable runs its own program, which needs neither a source file nor the parser's deep stack. It can still bundle others.
+    try {
+        if (!options.bundle && is_bundle()) {
+            return run_bundled(options, embedded_program());
         }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
+#endif
 
-    return 0;
+#ifdef KLANG_STACK_THREAD
+    size_t stackSize = options.stackSize;
+#else
+    size_t stackSize = size_t(8) << 20;
+#endif
+    //Keeps a megabyte of the stack for the frames below the recursion and for printing errors.
+    Parser::depthLimit = (stackSize - std::min(stackSize / 2, size_t(1) << 20)) / Parser::levelBytes;
+    try {
+        return run_with_stack(stackSize, [&]() {
+#ifdef KLANG_BUNDLE
+            if (options.bundle) return write_bundle(options);
+#endif
+            return interpret(options);
+        });
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 }
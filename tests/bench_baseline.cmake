@@ -0,0 +1,89 @@
+# Saves a --bench baseline of a small workload and compares a second suite against it: as saved, then with its samples replaced by
+# fixed ones far below and far above anything measured. Samples far below must give the p-value of two completely separated sets of
+# five (0.0061) and regress every phase with exit status 1; samples far above must give a p-value near 1 and no regression.
+#   KLANG  the interpreter
+#   WORK   a directory for scratch files
+
+set(dir "${WORK}/bench_baseline")
+file(REMOVE_RECURSE "${dir}")
+file(MAKE_DIRECTORY "${dir}")
+set(source "x = 0\nfor i = 1 to 50\n    x = x + i * 3\nend\nprint(x)\n")
+file(WRITE "${dir}/loop.txt" "${source}")
+set(saved "${WORK}/bench_baseline.json")
+set(edited "${WORK}/bench_baseline_edited.json")
+
+# Runs the suite with --bench-runs=5 and the remaining arguments, and sets 'out', 'err' and 'status' in the caller.
+function(bench)
+    execute_process(COMMAND "${KLANG}" --bench=${dir} --bench-runs=5 ${ARGN} OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+    set(out "${out}" PARENT_SCOPE)
+    set(err "${err}" PARENT_SCOPE)
+    set(status "${status}" PARENT_SCOPE)
+endfunction()
+
+# Checks that each of the three phases has a result line matching 'pattern'.
+function(check_phases pattern)
+    foreach(phase lex parse run)
+        if(NOT out MATCHES "loop\\.txt ${phase}: median [0-9.]+ us[^\n]*${pattern}")
+            message(FATAL_ERROR "Expected the ${phase} phase to match '${pattern}', got status ${status} and\n${out}\n${err}")
+        endif()
+    endforeach()
+endfunction()
+
+bench(--save-baseline=${saved})
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Expected the suite to run, got status ${status} and\n${out}\n${err}")
+endif()
+file(READ "${saved}" json)
+string(LENGTH "${source}" bytes)
+string(JSON runs GET "${json}" runs)
+string(JSON count LENGTH "${json}" results)
+if(NOT runs EQUAL 5 OR NOT count EQUAL 3)
+    message(FATAL_ERROR "Expected 5 runs of 3 phases in the baseline, got\n${json}")
+endif()
+set(k 0)
+foreach(phase lex parse run)
+    string(JSON result GET "${json}" results ${k})
+    string(JSON workload GET "${result}" workload)
+    string(JSON saved_phase GET "${result}" phase)
+    string(JSON saved_bytes GET "${result}" bytes)
+    string(JSON samples LENGTH "${result}" samples_ns)
+    if(NOT workload STREQUAL "loop.txt" OR NOT saved_phase STREQUAL phase OR NOT saved_bytes EQUAL bytes OR NOT samples EQUAL 5)
+        message(FATAL_ERROR "Expected 5 samples of loop.txt ${phase} in\n${result}")
+    endif()
+    math(EXPR k "${k} + 1")
+endforeach()
+
+# As saved: the comparison runs, with a threshold no timing noise reaches.
+bench(--baseline=${saved} --bench-threshold=1000000)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Expected no regression against the saved baseline, got status ${status} and\n${out}\n${err}")
+endif()
+check_phases(", baseline [0-9.]+ us, [-+][0-9.]+%, p=[0-9.]+\n")
+
+# Writes the baseline with every phase's samples replaced by 'samples', a JSON array.
+function(edit_baseline samples)
+    set(copy "${json}")
+    foreach(k 0 1 2)
+        string(JSON copy SET "${copy}" results ${k} samples_ns "${samples}")
+    endforeach()
+    file(WRITE "${edited}" "${copy}")
+endfunction()
+
+# Far below: every measured sample ranks above every baseline sample. Ties among the measured samples could only move the last digit.
+edit_baseline("[1, 2, 3, 4, 5]")
+bench(--baseline=${edited})
+if(NOT status EQUAL 1 OR NOT err MATCHES "3 significant regressions against")
+    message(FATAL_ERROR "Expected 3 regressions and exit status 1, got status ${status} and\n${out}\n${err}")
+endif()
+check_phases(", baseline 0\\.0 us, \\+[0-9.]+%, p=0\\.00(59|60|61)  REGRESSION\n")
+
+# Far above: the suite got faster, which is no regression however significant.
+edit_baseline("[1000000000000, 1000000000001, 1000000000002, 1000000000003, 1000000000004]")
+bench(--baseline=${edited})
+if(NOT status EQUAL 0 OR out MATCHES "REGRESSION")
+    message(FATAL_ERROR "Expected no regression against a slower baseline, got status ${status} and\n${out}\n${err}")
+endif()
+check_phases(", baseline 1000000000\\.0 us, -[0-9.]+%, p=0\\.99[0-9]+\n")
+
+file(REMOVE_RECURSE "${dir}")
+file(REMOVE "${saved}" "${edited}")
@@ -0,0 +1,25 @@
+# Bundles PROGRAM and checks that the bundle runs it, and that it rejects options it has no use for instead of ignoring them.
+#   KLANG    the interpreter
+#   PROGRAM  the program to bundle
+#   WORK     a directory for scratch files
+
+file(MAKE_DIRECTORY "${WORK}")
+set(bundle "${WORK}/bundle_options.bundle")
+execute_process(COMMAND "${KLANG}" --bundle -o "${bundle}" "${PROGRAM}" RESULT_VARIABLE status ERROR_VARIABLE err)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Bundling ${PROGRAM} failed:\n${err}")
+endif()
+
+execute_process(COMMAND "${KLANG}" -O0 "${PROGRAM}" OUTPUT_VARIABLE expected)
+execute_process(COMMAND "${bundle}" --output-format=text OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+if(NOT status EQUAL 0 OR NOT out STREQUAL expected)
+    message(FATAL_ERROR "The bundle exited with status ${status} and printed\n${out}\n${err}\ninstead of\n${expected}")
+endif()
+
+foreach(option "--engine=ast" "-O0" "--unroll=4" "--lazy" "--tiered" "--dump-ir" "${PROGRAM}")
+    execute_process(COMMAND "${bundle}" ${option} OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+    if(status EQUAL 0 OR NOT out STREQUAL "" OR err STREQUAL "")
+        message(FATAL_ERROR "The bundle accepted ${option}: status ${status}, printed\n${out}")
+    endif()
+endforeach()
+file(REMOVE "${bundle}")
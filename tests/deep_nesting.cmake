@@ -0,0 +1,50 @@
+# Runs a program that nests DEPTH levels deep and checks what it prints. With STACK set, the interpreter runs with --stack-size=STACK,
+# which is too small for the program, and must reject it with an error rather than overflow its stack.
+#   KLANG  the interpreter
+#   KIND   "if" for nested if statements, "for" and "while" for nested loops that each run once, "parentheses" for additions nested
+#          in parentheses, 1 + (1 + (...)), each one a level deeper, or "sum" for a flat chain of additions
+#   DEPTH  the levels of nesting
+#   WORK   a directory for scratch files
+
+if(KIND STREQUAL "if")
+    string(REPEAT "if x > 0 then\n" ${DEPTH} open)
+    string(REPEAT "end\n" ${DEPTH} close)
+    set(source "x = 1\n${open}print(x)\n${close}")
+    set(expected "1\n")
+elseif(KIND STREQUAL "for")
+    string(REPEAT "for i = 1 to 1\n" ${DEPTH} open)
+    string(REPEAT "end\n" ${DEPTH} close)
+    set(source "x = 0\n${open}x = x + 1\n${close}print(x)\n")
+    set(expected "1\n")
+elseif(KIND STREQUAL "while")
+    string(REPEAT "while x < 1 then\n" ${DEPTH} open)
+    string(REPEAT "end\n" ${DEPTH} close)
+    set(source "x = 0\n${open}x = x + 1\n${close}print(x)\n")
+    set(expected "1\n")
+elseif(KIND STREQUAL "parentheses")
+    string(REPEAT "1 + (" ${DEPTH} open)
+    string(REPEAT ")" ${DEPTH} close)
+    set(source "x = ${open}1${close}\nprint(x)\n")
+    math(EXPR total "${DEPTH} + 1")
+    set(expected "${total}\n")
+else()
+    string(REPEAT " + 1" ${DEPTH} terms)
+    set(source "x = 0${terms}\nprint(x)\n")
+    set(expected "${DEPTH}\n")
+endif()
+
+file(MAKE_DIRECTORY "${WORK}")
+set(program "${WORK}/deep_${KIND}_${DEPTH}.txt")
+file(WRITE "${program}" "${source}")
+if(STACK)
+    execute_process(COMMAND "${KLANG}" --stack-size=${STACK} "${program}" OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+    if(status EQUAL 0 OR NOT err MATCHES "nests too deeply")
+        message(FATAL_ERROR "Expected a nesting error with a ${STACK} MiB stack, got status ${status}:\n${err}")
+    endif()
+else()
+    execute_process(COMMAND "${KLANG}" "${program}" OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+    if(NOT status EQUAL 0 OR NOT out STREQUAL expected)
+        message(FATAL_ERROR "${DEPTH} levels of ${KIND} exited with status ${status} and printed\n${out}\n${err}")
+    endif()
+endif()
+file(REMOVE "${program}")
@@ -0,0 +1,23 @@
+# Runs isolates of different lengths through --inputs on more threads than there are isolates, and checks that every one finishes and
+# the outputs come in the order of the lines.
+#   KLANG  the interpreter
+#   WORK   a directory for scratch files
+
+file(MAKE_DIRECTORY "${WORK}")
+set(program "${WORK}/isolate_threads.txt")
+set(inputs "${WORK}/isolate_threads.inputs")
+file(WRITE "${program}" "x = 0\nfor i = 1 to n\nx = x + i\nend\nprint(x)\n")
+set(lines "")
+set(expected "")
+foreach(n 1 2000 10 500 3)
+    string(APPEND lines "n=${n}\n")
+    math(EXPR sum "${n} * (${n} + 1) / 2")
+    string(APPEND expected "${sum}\n")
+endforeach()
+file(WRITE "${inputs}" "${lines}")
+execute_process(COMMAND "${KLANG}" --threads=8 --slice=1 --inputs=${inputs} "${program}"
+                OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+if(NOT status EQUAL 0 OR NOT out STREQUAL expected)
+    message(FATAL_ERROR "Expected\n${expected}\ngot status ${status} and\n${out}\n${err}")
+endif()
+file(REMOVE "${program}" "${inputs}")
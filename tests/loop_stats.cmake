@@ -0,0 +1,74 @@
+# Runs a program with known trip counts under --loop-stats and checks each loop's entries, iterations and trip-count histogram, leaving
+# out the times and so the order. Under -O0 every loop is listed as written; with optimization on, the constant inner loop on line 3 is
+# fully unrolled and disappears, the loop on line 15 is fused into the one on line 12, and partially unrolled loops count their
+# iterations as written.
+#   KLANG   the interpreter
+#   CONFIG  the options, separated by '|'
+#   WORK    a directory for scratch files
+
+string(REPLACE "|" ";" flags "${CONFIG}")
+string(MAKE_C_IDENTIFIER "${CONFIG}" tag)
+file(MAKE_DIRECTORY "${WORK}")
+set(program "${WORK}/loop_stats${tag}.txt")
+file(WRITE "${program}" [[
+w = 0
+for i = 1 to 4
+    for j = 1 to 3
+        w = w + j
+    end
+    for k = 1 to i - 1
+        w = w + k
+    end
+end
+y = 0
+z = 0
+for a = 1 to 5
+    y = y + a
+end
+for a = 1 to 5
+    z = z + a
+end
+k = 0
+while k < 9 then
+    k = k + 1
+end
+while k < 9 then
+    k = k + 1
+end
+print(w, y, z, k)
+]])
+execute_process(COMMAND "${KLANG}" ${flags} --loop-stats "${program}" OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+if(NOT status EQUAL 0 OR NOT out STREQUAL "34 15 15 9\n")
+    message(FATAL_ERROR "Expected the program to print 34 15 15 9, got status ${status} and\n${out}\n${err}")
+endif()
+
+# One list entry per loop: its summary line and its histogram line, without the time.
+string(REGEX REPLACE ", [0-9.]+ ms\n    trip counts:" ", trip counts:" loops "${err}")
+string(REGEX REPLACE "\n$" "" loops "${loops}")
+string(REPLACE "\n" ";" loops "${loops}")
+list(POP_FRONT loops header)
+
+set(expected
+    "line 2 (for): 1 entries, 4 iterations, trip counts: 4-7 (1 run)"
+    "line 6 (for): 4 entries, 6 iterations, trip counts: 0 (1 run), 1 (1 run), 2-3 (2 runs)"
+    "line 12 (for): 1 entries, 5 iterations, trip counts: 4-7 (1 run)"
+    "line 19 (while): 1 entries, 9 iterations, trip counts: 8-15 (1 run)"
+    "line 22 (while): 1 entries, 0 iterations, trip counts: 0 (1 run)")
+if(CONFIG STREQUAL "-O0")
+    list(APPEND expected
+         "line 3 (for): 4 entries, 12 iterations, trip counts: 2-3 (4 runs)"
+         "line 15 (for): 1 entries, 5 iterations, trip counts: 4-7 (1 run)")
+endif()
+list(LENGTH expected count)
+if(NOT header STREQUAL "loop stats: ${count} loops, by time spent in them")
+    message(FATAL_ERROR "Expected ${count} loops, got\n${err}")
+endif()
+list(SORT loops)
+list(SORT expected)
+if(NOT loops STREQUAL expected)
+    string(REPLACE ";" "\n" loops "${loops}")
+    string(REPLACE ";" "\n" expected "${expected}")
+    message(FATAL_ERROR "Expected the loops\n${expected}\ngot\n${loops}")
+endif()
+
+file(REMOVE "${program}")
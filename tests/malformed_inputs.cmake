@@ -0,0 +1,17 @@
+# Runs a program through --inputs with an invalid input on one line, and checks that only that line fails.
+#   KLANG  the interpreter
+#   WORK   a directory for scratch files
+
+file(MAKE_DIRECTORY "${WORK}")
+set(program "${WORK}/malformed_inputs.txt")
+set(inputs "${WORK}/malformed_inputs.inputs")
+file(WRITE "${program}" "print(a * 10)\n")
+file(WRITE "${inputs}" "a=1\na=x\n2=a\na=4\n")
+execute_process(COMMAND "${KLANG}" --inputs=${inputs} "${program}" OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+if(status EQUAL 0 OR NOT out STREQUAL "10\n40\n")
+    message(FATAL_ERROR "Expected the valid lines to print 10 and 40 and the run to fail, got status ${status} and\n${out}\n${err}")
+endif()
+if(NOT err MATCHES "line 2 of [^\n]*: Invalid input: a=x" OR NOT err MATCHES "line 3 of [^\n]*: Invalid input: 2=a")
+    message(FATAL_ERROR "Expected errors for lines 2 and 3, got\n${err}")
+endif()
+file(REMOVE "${program}" "${inputs}")
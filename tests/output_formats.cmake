@@ -0,0 +1,45 @@
+# Checks the exact bytes --output-format=binary writes and the lines --output-format=ndjson writes: prints of several values, of a
+# negative value and of INT32_MIN, and a print that fails after its first value, which must write no record. There is no empty print:
+# print() is a syntax error, and the prints before it must still be written in full.
+#   KLANG   the interpreter
+#   CONFIG  the options, separated by '|'
+#   WORK    a directory for scratch files
+
+string(REPLACE "|" ";" flags "${CONFIG}")
+string(MAKE_C_IDENTIFIER "${CONFIG}" tag)
+file(MAKE_DIRECTORY "${WORK}")
+set(program "${WORK}/output_formats${tag}.txt")
+set(output "${WORK}/output_formats${tag}.out")
+
+# Runs 'source' with 'format', which must fail with 'error', and checks that it wrote the remaining arguments, joined: hex bytes for
+# binary, text for ndjson.
+function(check_output source format error)
+    string(JOIN "" expected ${ARGN})
+    file(WRITE "${program}" "${source}")
+    execute_process(COMMAND "${KLANG}" ${flags} --output-format=${format} "${program}"
+                    OUTPUT_FILE "${output}" ERROR_VARIABLE err RESULT_VARIABLE status)
+    if(status EQUAL 0 OR NOT err MATCHES "${error}")
+        message(FATAL_ERROR "Expected ${format} output to end in '${error}', got status ${status}:\n${err}")
+    endif()
+    if(format STREQUAL "binary")
+        file(READ "${output}" written HEX)
+    else()
+        file(READ "${output}" written)
+    endif()
+    if(NOT written STREQUAL expected)
+        message(FATAL_ERROR "${format} output of\n${source}was\n${written}\ninstead of\n${expected}")
+    endif()
+endfunction()
+
+set(values "z = 0\nn = 0 - 2\nprint(1, n, 300)\nprint(n * 1073741824)\nprint(7, 8 / z)\nprint(9)\n")
+# Each record is its value count as a little-endian uint32, then each value as a little-endian int64.
+check_output("${values}" binary "Division by zero"
+             "03000000" "0100000000000000" "feffffffffffffff" "2c01000000000000"
+             "01000000" "00000080ffffffff")
+check_output("${values}" ndjson "Division by zero" "[1,-2,300]\n[-2147483648]\n")
+
+set(empty "print(1)\nprint()\nprint(2)\n")
+check_output("${empty}" binary "Syntax error" "01000000" "0100000000000000")
+check_output("${empty}" ndjson "Syntax error" "[1]\n")
+
+file(REMOVE "${program}" "${output}")
@@ -0,0 +1,56 @@
+# Runs one test program under one configuration of the interpreter and fails unless its output and exit status match the reference
+# run with -O0. The reference output is checked against <program>.expected when that file exists.
+#   KLANG    the interpreter
+#   PROGRAM  the source file
+#   CONFIG   the options, separated by '|', or "isolate" to run the program in one isolate through --inputs, or "bundle" to run it from a
+#            bundled executable
+#   WORK     a directory for scratch files
+
+function(run_klang result output)
+    execute_process(COMMAND ${ARGN} OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+    set(${result} "${status}" PARENT_SCOPE)
+    set(${output} "${out}" PARENT_SCOPE)
+endfunction()
+
+run_klang(referenceStatus reference "${KLANG}" -O0 "${PROGRAM}")
+get_filename_component(expectedPath "${PROGRAM}" DIRECTORY)
+get_filename_component(name "${PROGRAM}" NAME_WE)
+set(expectedPath "${expectedPath}/${name}.expected")
+if(EXISTS "${expectedPath}")
+    file(READ "${expectedPath}" expected)
+    if(NOT reference STREQUAL expected)
+        message(FATAL_ERROR "-O0 printed\n${reference}\nbut ${expectedPath} expects\n${expected}")
+    endif()
+endif()
+
+string(REPLACE "|" ";" flags "${CONFIG}")
+string(REPLACE "|" " " label "${CONFIG}")
+if(label STREQUAL "")
+    set(label "the default options")
+endif()
+if(CONFIG STREQUAL "bundle")
+    file(MAKE_DIRECTORY "${WORK}")
+    set(bundle "${WORK}/${name}.bundle")
+    run_klang(status out "${KLANG}" --bundle -o "${bundle}" "${PROGRAM}")
+    if(NOT status EQUAL 0)
+        if(referenceStatus EQUAL 0)
+            message(FATAL_ERROR "--bundle failed with status ${status}")
+        endif()
+        return()
+    endif()
+    run_klang(status out "${bundle}")
+elseif(CONFIG STREQUAL "isolate")
+    # One line with no inputs runs the program once.
+    file(MAKE_DIRECTORY "${WORK}")
+    file(WRITE "${WORK}/${name}.inputs" "\n")
+    run_klang(status out "${KLANG}" "--inputs=${WORK}/${name}.inputs" "${PROGRAM}")
+else()
+    run_klang(status out "${KLANG}" ${flags} "${PROGRAM}")
+endif()
+
+if(NOT out STREQUAL reference)
+    message(FATAL_ERROR "${label} printed\n${out}\nbut -O0 printed\n${reference}")
+endif()
+if((status EQUAL 0) AND NOT (referenceStatus EQUAL 0) OR (referenceStatus EQUAL 0) AND NOT (status EQUAL 0))
+    message(FATAL_ERROR "${label} exited with status ${status} but -O0 exited with ${referenceStatus}")
+endif()
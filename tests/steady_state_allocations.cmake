@@ -0,0 +1,30 @@
+# Fails if executing a warmed-up loop allocates. The workload runs inside an outer loop of 10 rounds and then of 100, and --alloc-report
+# counts the allocations made while executing each. Slots, loop scratch space and tiered copies are set up in the first round, so the
+# two counts differ by exactly what the 90 extra rounds allocated, which must be nothing.
+#   KLANG     the interpreter
+#   WORKLOAD  the source of one round
+#   CONFIG    the options, separated by '|'
+#   WORK      a directory for scratch files
+
+file(READ "${WORKLOAD}" workload)
+string(REPLACE "|" ";" flags "${CONFIG}")
+string(MAKE_C_IDENTIFIER "${CONFIG}" tag)
+file(MAKE_DIRECTORY "${WORK}")
+
+foreach(rounds 10 100)
+    set(program "${WORK}/allocations${tag}_${rounds}.txt")
+    file(WRITE "${program}" "for round = 1 to ${rounds}\n${workload}end\n")
+    execute_process(COMMAND "${KLANG}" ${flags} --alloc-report "${program}" OUTPUT_QUIET ERROR_VARIABLE report RESULT_VARIABLE status)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "${rounds} rounds failed with status ${status}:\n${report}")
+    endif()
+    if(NOT report MATCHES "allocations in execute: ([0-9]+)")
+        message(FATAL_ERROR "No execute count in the report:\n${report}")
+    endif()
+    set(allocations_${rounds} ${CMAKE_MATCH_1})
+endforeach()
+
+math(EXPR steady "${allocations_100} - ${allocations_10}")
+if(NOT steady EQUAL 0)
+    message(FATAL_ERROR "${steady} allocations while executing 90 warmed-up rounds (${allocations_10} in 10 rounds, ${allocations_100} in 100)")
+endif()
@@ -0,0 +1,67 @@
+# Runs a three-statement program with --trace and parses the file it writes as JSON: it must hold complete ("X") events for reading
+# the source, for parsing each line, and for optimizing and executing each statement, with their categories and lines, and none dropped.
+#   KLANG   the interpreter
+#   CONFIG  the options, separated by '|'
+#   WORK    a directory for scratch files
+
+string(REPLACE "|" ";" flags "${CONFIG}")
+string(MAKE_C_IDENTIFIER "${CONFIG}" tag)
+file(MAKE_DIRECTORY "${WORK}")
+set(program "${WORK}/trace_events${tag}.txt")
+set(trace "${WORK}/trace_events${tag}.json")
+set(source "x = 1\ny = x + 2\nprint(x, y)\n")
+file(WRITE "${program}" "${source}")
+file(REMOVE "${trace}")
+execute_process(COMMAND "${KLANG}" ${flags} --trace=${trace} "${program}" OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE status)
+if(NOT status EQUAL 0 OR NOT out STREQUAL "1 3\n")
+    message(FATAL_ERROR "Expected the program to print 1 3, got status ${status} and\n${out}\n${err}")
+endif()
+
+file(READ "${trace}" json)
+string(JSON dropped ERROR_VARIABLE error GET "${json}" otherData droppedEvents)
+if(error OR NOT dropped EQUAL 0)
+    message(FATAL_ERROR "Expected otherData.droppedEvents to be 0 in\n${json}\n${error}")
+endif()
+string(JSON count LENGTH "${json}" traceEvents)
+math(EXPR last "${count} - 1")
+set(events "")
+foreach(i RANGE ${last})
+    string(JSON event GET "${json}" traceEvents ${i})
+    string(JSON name GET "${event}" name)
+    string(JSON cat GET "${event}" cat)
+    string(JSON ph GET "${event}" ph)
+    string(JSON ts GET "${event}" ts)
+    string(JSON dur GET "${event}" dur)
+    if(NOT ph STREQUAL "X" OR ts LESS 0 OR dur LESS 0)
+        message(FATAL_ERROR "Expected a complete event with a start and a duration, got\n${event}")
+    endif()
+    # Key each event by what it covers: the source size, the parsed line, or the statement and its line.
+    if(name STREQUAL "read source")
+        string(JSON bytes GET "${event}" args bytes)
+        list(APPEND events "${name}/${cat}/${bytes}")
+    elseif(name STREQUAL "parse")
+        string(JSON line GET "${event}" args line)
+        list(APPEND events "${name}/${cat}/${line}")
+    else()
+        string(JSON statement GET "${event}" args statement)
+        string(JSON line GET "${event}" args line)
+        list(APPEND events "${name}/${cat}/${statement}:${line}")
+    endif()
+endforeach()
+
+string(LENGTH "${source}" bytes)
+set(expected "read source/phase/${bytes}")
+foreach(line 1 2 3)
+    list(APPEND expected "parse/parse/${line}" "optimize/optimize/${line}:${line}" "statement/execute/${line}:${line}")
+endforeach()
+list(GET events 0 first)
+if(NOT first MATCHES "^read source/")
+    message(FATAL_ERROR "Expected reading the source to be the first event, got ${first}")
+endif()
+list(SORT events)
+list(SORT expected)
+if(NOT events STREQUAL expected)
+    message(FATAL_ERROR "Expected the events\n${expected}\ngot\n${events}")
+endif()
+
+file(REMOVE "${program}" "${trace}")